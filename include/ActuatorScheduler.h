@@ -0,0 +1,49 @@
+#ifndef ACTUATORSCHEDULER_H
+#define ACTUATORSCHEDULER_H
+
+#include <Arduino.h>
+
+#define ACTUATOR_MAX_CHANNELS 4
+
+// no actuator stays on longer than this, whatever was requested
+#ifndef ACTUATOR_MAX_ON_MS
+#define ACTUATOR_MAX_ON_MS (30UL * 60 * 1000)
+#endif
+
+typedef std::function<void(const char *name, bool on)> OnActuatorChange;
+
+struct ActuatorChannel
+{
+  const char *name;
+  uint8_t pin;
+  volatile bool on = false;
+  volatile uint32_t startedMs = 0;
+  volatile uint32_t offAtMs = 0;
+  bool reportedOn = false;
+};
+
+// runs any number of actuators at the same time; each one is switched off by
+// the hardware timer the moment its time is up, so nothing has to wait in a
+// delay loop for it, and the transitions are reported from `poll`
+struct ActuatorScheduler
+{
+  ActuatorChannel _channels[ACTUATOR_MAX_CHANNELS];
+  uint8_t _count = 0;
+  OnActuatorChange _onChange;
+
+  void begin(OnActuatorChange);
+  int8_t addChannel(const char *name, uint8_t pin);
+  // switches the channel on, or extends its run, for the given duration
+  bool run(uint8_t channel, uint32_t durationMs);
+  void stop(uint8_t channel);
+  bool anyOn();
+  void poll();
+
+  void IRAM_ATTR switchOffDue();
+  void IRAM_ATTR armTimer();
+};
+
+// parses a duration in whole seconds, as sent over MQTT, into milliseconds
+uint32_t parseDurationMs(const char *seconds);
+
+#endif
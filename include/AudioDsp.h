@@ -0,0 +1,59 @@
+#ifndef AUDIODSP_H
+#define AUDIODSP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// fixed-point formats used by the stage
+#define DSP_GAIN_SHIFT 12  // gains are Q12, 4096 is unity
+#define DSP_COEFF_SHIFT 28 // biquad coefficients are Q28
+#define DSP_EQ_BANDS 3
+
+enum BiquadType
+{
+  LowShelf,
+  Peaking,
+  HighShelf
+};
+
+struct Biquad
+{
+  int32_t b0, b1, b2, a1, a2;
+  bool bypass = true;
+
+  void design(BiquadType type, float sampleRate, float freq, float gainDb, float q);
+};
+
+// per channel history of a direct form I biquad
+struct BiquadState
+{
+  int32_t x1, x2, y1, y2;
+};
+
+// post-decode processing of interleaved 16 bit stereo: per-track loudness
+// normalization, volume, a bass/mid/treble EQ and a soft limiter, all in
+// integer arithmetic so it stays far below the per-frame budget on the ESP32
+struct AudioDsp
+{
+  uint32_t _sampleRate = 44100;
+  float _eqDb[DSP_EQ_BANDS] = {0, 0, 0};
+  Biquad _eq[DSP_EQ_BANDS];
+  BiquadState _eqState[DSP_EQ_BANDS][2] = {};
+
+  int32_t _trackGain = 1 << DSP_GAIN_SHIFT;
+  int32_t _volumeGain = 0;
+  int32_t _volumeTarget = 0;
+
+  // loudness of the decoded track, before any gain is applied
+  uint64_t _sumSquares = 0;
+  uint32_t _measuredFrames = 0;
+
+  void setSampleRate(uint32_t sampleRate);
+  void setEq(float bassDb, float midDb, float trebleDb);
+  void setVolume(uint8_t volume);
+  void beginTrack(int16_t gainCentiDb);
+  bool measureTrackGain(float targetDbfs, int16_t &gainCentiDb);
+  void process(int16_t *frames, size_t count);
+};
+
+#endif
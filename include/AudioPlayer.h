@@ -2,22 +2,32 @@
 #define AUDIOPLAYER_H
 
 #include "Audio.h"
+#include "Delegate.h"
 
-typedef std::function<void(String)> PublishState;
+// one field of the state as a JSON value, or the genre menu when field is
+// NULL, both to be kept retained; returns the packet id of the publish, 0 if
+// it could not be sent
+typedef Delegate<uint16_t(const char *field, const char *payload, size_t length)> PublishState;
 
-// keeps the logic of manipulating the "audio" lib to play audio
+struct AudioSource;
+
+// keeps the logic of manipulating the "audio" lib to play audio; the
+// on*Requested handlers may be called from any one other task, everything
+// else belongs to the task running `start` and `loop`
 struct AudioPlayer
 {
   void init();
+  void init(AudioSource *);
   void start();
   void resume();
   void pause();
   void stop();
   void loop();
-  void onVolumeChangeRequested(std::string);
-  void onStateChangeRequested(std::string);
-  void onGenreChangeRequested(std::string);
-  void setPublishStateFn(PublishState);
+  void applyPendingControls(unsigned long now);
+  void onVolumeChangeRequested(const char *payload, size_t length);
+  void onStateChangeRequested(const char *payload, size_t length);
+  void onGenreChangeRequested(const char *payload, size_t length);
+  void setPublishStateFn(const PublishState &);
 };
 
 #endif
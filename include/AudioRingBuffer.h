@@ -0,0 +1,72 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+
+// single producer / single consumer byte ring; the producer and the consumer
+// work directly on the regions handed out, so no bytes are copied twice
+struct AudioRingBuffer
+{
+  uint8_t *_buf = nullptr;
+  size_t _capacity = 0;
+  std::atomic<size_t> _written{0};
+  std::atomic<size_t> _read{0};
+
+  // prefers PSRAM and falls back to internal RAM with the fallback size; both
+  // sizes must be powers of two so the running counters can wrap around
+  bool init(size_t capacity, size_t fallbackCapacity)
+  {
+    _buf = (uint8_t *)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    _capacity = capacity;
+    if (_buf == nullptr)
+    {
+      _buf = (uint8_t *)heap_caps_malloc(fallbackCapacity, MALLOC_CAP_8BIT);
+      _capacity = fallbackCapacity;
+    }
+    if (_buf == nullptr)
+    {
+      _capacity = 0;
+      return false;
+    }
+    clear();
+    return true;
+  }
+
+  void clear()
+  {
+    _written = 0;
+    _read = 0;
+  }
+
+  size_t capacity() { return _capacity; }
+
+  size_t available() { return _written.load() - _read.load(); }
+
+  size_t space() { return _capacity - available(); }
+
+  // contiguous region the producer may fill, followed by commitWrite
+  size_t writeRegion(uint8_t **ptr)
+  {
+    size_t pos = _written.load() % _capacity;
+    size_t len = min(space(), _capacity - pos);
+    *ptr = _buf + pos;
+    return len;
+  }
+
+  void commitWrite(size_t len) { _written += len; }
+
+  // contiguous region the consumer may drain, followed by commitRead
+  size_t readRegion(uint8_t **ptr)
+  {
+    size_t pos = _read.load() % _capacity;
+    size_t len = min(available(), _capacity - pos);
+    *ptr = _buf + pos;
+    return len;
+  }
+
+  void commitRead(size_t len) { _read += len; }
+};
+
+#endif
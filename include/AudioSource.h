@@ -1,6 +1,12 @@
+#ifndef AUDIOSOURCE_H
+#define AUDIOSOURCE_H
+
 #include <Arduino.h>
 #include "AudioPlayer.h"
 #include "Audio.h"
+#include "AudioRingBuffer.h"
+#include <HTTPClient.h>
+#include <FS.h>
 #include <list>
 #include <map>
 
@@ -37,14 +43,27 @@ struct AudioSource
   virtual void pause(){};
   virtual void resume(){};
   virtual void populateAudioMenu(AudioMenu &){};
+  virtual uint32_t getUnderrunCount() { return 0; };
+  // where the library index is kept, if the source has writable storage
+  virtual fs::FS *getLibraryFS() { return NULL; };
+
+  // sources that load their track lists lazily fill the genre in here
+  virtual void selectGenre(AudioMenu &menu, String genre)
+  {
+    menu.selectedGenre = genre;
+  };
 };
 
 struct DLNAAudioSource : AudioSource
 {
+  // maps each genre in the menu to the DLNA container it was browsed from
+  std::map<String, String> _genreContainerIds;
+
   void play(String, Audio *);
   void pause();
   void resume();
   void populateAudioMenu(AudioMenu &);
+  void selectGenre(AudioMenu &, String);
 };
 
 struct SDAudioSource : AudioSource
@@ -54,4 +73,65 @@ struct SDAudioSource : AudioSource
   void pause();
   void resume();
   void populateAudioMenu(AudioMenu &);
-};
\ No newline at end of file
+  fs::FS *getLibraryFS();
+};
+
+#define HTTP_AUDIO_URL_MAX_LEN 256
+
+// streams internet radio and HTTP files through a read-ahead buffer; the decoder
+// is pointed at a loopback proxy that serves it from the buffer, so a network
+// stall only drains the buffer instead of the decoder's own small input buffer
+struct HttpAudioSource : AudioSource
+{
+  std::map<String, list<String>> _urls;
+  char _url[HTTP_AUDIO_URL_MAX_LEN] = ""; // handed to the network task under _urlMux
+  std::atomic<uint32_t> _generation{0};
+  uint32_t _servedGeneration = 0;
+  portMUX_TYPE _urlMux = portMUX_INITIALIZER_UNLOCKED;
+
+  AudioRingBuffer _ring;
+  size_t _target = 0;
+  bool _buffering = true;
+  std::atomic<uint32_t> _underruns{0};
+
+  // upstream connection
+  HTTPClient _http;
+  WiFiClient *_upstream = nullptr;
+  String _contentType;
+  int32_t _contentLength = -1;
+  bool _acceptRanges = false;
+  size_t _offset = 0;
+  size_t _skip = 0;
+  bool _upstreamDone = false;
+  unsigned long _reconnectAtMs = 0;
+  uint8_t _reconnectAttempts = 0;
+
+  // network jitter and playback rate estimates driving the buffer target
+  unsigned long _lastArrivalMs = 0;
+  uint32_t _jitterMs = 0;
+  uint32_t _byteRate = 0;
+  size_t _servedInWindow = 0;
+  unsigned long _rateWindowStartMs = 0;
+
+  // loopback side the decoder reads from
+  WiFiServer *_proxyServer = nullptr;
+  WiFiClient _local;
+  bool _headerSent = false;
+
+  HttpAudioSource(std::map<String, list<String>> urls);
+  void play(String, Audio *);
+  void pause();
+  void resume();
+  void populateAudioMenu(AudioMenu &);
+  uint32_t getUnderrunCount();
+
+  void run();
+  void restart();
+  void connectUpstream();
+  void disconnectUpstream();
+  void fillFromUpstream();
+  void serveLocalClient();
+  void updateTarget();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef CAMPROFILE_H
+#define CAMPROFILE_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "FrameBroker.h"
+
+#ifndef CAM_DEFAULT_PROFILE
+#define CAM_DEFAULT_PROFILE "snapshot"
+#endif
+
+// frame rate the stream should hold; deliveries or captures slower than this
+// make the controller step down
+#ifndef CAM_STREAM_TARGET_FPS
+#define CAM_STREAM_TARGET_FPS 10
+#endif
+
+#define CAM_PROFILE_NAME_MAX_LEN 16
+
+// everything a profile changes on the sensor; the frame size can be anything
+// up to the one the driver was initialized with
+struct CamProfile
+{
+  const char *name;
+  framesize_t frameSize;
+  uint8_t quality; // 0-63, lower is better
+  int8_t brightness;
+  int8_t contrast;
+  int8_t saturation;
+  gainceiling_t gainCeiling;
+  bool nightMode; // longer exposures and a raised exposure level for low light
+};
+
+// picks the sensor settings of the active profile, stepping them down while
+// viewers cannot keep up and back up once they have been fine for a while;
+// sensor registers are only ever written from its own task
+struct CamQualityController
+{
+  FrameBroker *_frameBroker;
+  const CamProfile *_profile = nullptr;
+  uint8_t _level = 0;
+  bool _degraded = false;
+
+  // requested over MQTT, applied by the controller task
+  char _pendingProfile[CAM_PROFILE_NAME_MAX_LEN] = "";
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+  // deliveries reported by the stream servers in the current window
+  uint32_t _deliveries = 0;
+  uint32_t _slowDeliveries = 0;
+  uint32_t _deliveryMsSum = 0;
+  unsigned long _windowStartMs = 0;
+  unsigned long _lastPressureMs = 0;
+  unsigned long _lastDeliveryMs = 0;
+
+  static const CamProfile *findProfile(const char *name);
+
+  void begin(FrameBroker *);
+  void loop();
+  bool requestProfile(const char *name);
+  // time a viewer took to receive one whole frame
+  void reportDelivery(uint32_t ms);
+
+  void applyProfile(const CamProfile *);
+  void applyLevel(uint8_t level);
+  void evaluate(unsigned long now);
+};
+
+#endif
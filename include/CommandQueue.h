@@ -0,0 +1,77 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// lock-free queue for any number of producer tasks and exactly one consumer
+// task; it never allocates, and a full queue rejects the push instead of
+// blocking the producer. Every slot carries a sequence number telling whose
+// turn it is: a producer claims a slot by moving _head past it, and the
+// consumer only reads it once the producer has published it.
+template <typename T, size_t N>
+struct CommandQueue
+{
+  static_assert((N & (N - 1)) == 0, "CommandQueue capacity must be a power of two");
+
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence;
+    T item;
+  };
+
+  Slot _slots[N];
+  std::atomic<uint32_t> _head{0}; // next slot a producer claims
+  uint32_t _tail = 0;             // next slot the consumer reads, only the consumer touches it
+
+  CommandQueue()
+  {
+    for (uint32_t i = 0; i < N; i++)
+    {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool push(const T &item)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    while (true)
+    {
+      Slot &slot = _slots[head & (N - 1)];
+      int32_t lag = (int32_t)(slot.sequence.load(std::memory_order_acquire) - head);
+      if (lag < 0)
+      {
+        // the consumer has not read this slot a lap ago yet
+        return false;
+      }
+      if (lag > 0)
+      {
+        // another producer took it first
+        head = _head.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+      {
+        slot.item = item;
+        slot.sequence.store(head + 1, std::memory_order_release);
+        return true;
+      }
+    }
+  }
+
+  bool pop(T &item)
+  {
+    Slot &slot = _slots[_tail & (N - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != _tail + 1)
+    {
+      return false;
+    }
+    item = slot.item;
+    slot.sequence.store(_tail + N, std::memory_order_release);
+    _tail++;
+    return true;
+  }
+};
+
+#endif
@@ -3,110 +3,178 @@
 
 #include <AsyncMqttClient.h>
 #include <ArduinoJson.h>
-#include <string>
 #include <map>
 #include "MqttHandler.h"
+#include "RuleEngine.h"
+#include "DeviceState.h"
 #include "Config.h"
 #include <vector>
+#ifdef ESP32
+#include <rom/crc.h>
+#endif
 
 using namespace std;
 
-typedef std::function<void(string)> MessageTriggeredActionFn;
-
+// subscribed with the QoS of its topic in the topic table
 struct MessageTriggeredAction
 {
-  String topic;
+  TopicId topic = TopicNone;
   MessageTriggeredActionFn fn;
-  uint8_t qos = 0;
-  MessageTriggeredAction(String topic, MessageTriggeredActionFn fn, uint8_t qos = 0)
+
+  MessageTriggeredAction() {}
+  MessageTriggeredAction(TopicId topic, const MessageTriggeredActionFn &fn)
   {
     this->topic = topic;
     this->fn = fn;
-    this->qos = qos;
   }
 };
 
+// the node's own actions plus the rules topic
+#define COMMUNICATION_MAX_ACTIONS 8
+// the rules and the watering schedule are the longest payloads
+#define COMMUNICATION_MAX_PAYLOAD_LEN 1024
+
 struct CommunicationManager
 {
   MqttHandler *_mqttHandler;
+  RuleEngine _rules;
+  MessageTriggeredAction _actions[COMMUNICATION_MAX_ACTIONS];
+  uint8_t _actionCount = 0;
+  // the payload being put together and dispatched, null-terminated; messages
+  // only arrive on the MQTT task
+  char _payload[COMMUNICATION_MAX_PAYLOAD_LEN + 1];
+  size_t _payloadLength = 0;
 
-  void init(MqttHandler *mqttHandler, std::vector<MessageTriggeredAction> messageTriggeredActions = {})
+  void init(MqttHandler *mqttHandler, std::initializer_list<MessageTriggeredAction> messageTriggeredActions = {})
   {
     _mqttHandler = mqttHandler;
-    _mqttHandler->onConnect([this, messageTriggeredActions](bool sessionPresent)
-                            { this->onConnect(sessionPresent, messageTriggeredActions); });
-    _mqttHandler->onMessage([this, messageTriggeredActions](char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
-                            { this->onMessage(topic, payload, properties, len, index, total, messageTriggeredActions); });
+    for (const MessageTriggeredAction &action : messageTriggeredActions)
+    {
+      addAction(action);
+      _rules.addAction(topics.get(action.topic), action.fn);
+    }
+    // topics the rules listen to are subscribed to again whenever the
+    // retained rules are delivered
+    addAction(MessageTriggeredAction(TopicRules, [this](const char *payload, size_t length)
+                                     { _rules.compile(payload, [this](const char *topic)
+                                                      { _mqttHandler->subscribe(topic, 1); }); }));
+
+    _mqttHandler->onConnect([this](bool sessionPresent)
+                            { this->onConnect(sessionPresent); });
+    _mqttHandler->onMessage([this](char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+                            { this->onMessage(topic, payload, properties, len, index, total); });
   }
 
-  virtual void onConnect(bool sessionPresent, std::vector<MessageTriggeredAction> messageTriggeredActions)
+  void addAction(const MessageTriggeredAction &action)
   {
-    Serial.println("Connected to MQTT.");
-    if (messageTriggeredActions.size() > 0)
+    if (_actionCount == COMMUNICATION_MAX_ACTIONS)
     {
-      for (auto action : messageTriggeredActions)
-      {
-        _mqttHandler->subscribe(action.topic.c_str(), action.qos);
-      }
+      Serial.printf("Too many message triggered actions, %s left out.\n", topics.get(action.topic));
+      return;
     }
+    _actions[_actionCount++] = action;
+    // the rules are only kept in RAM, so they are fetched again on every connect
+    _mqttHandler->addSubscription(action.topic, action.topic == TopicRules);
   }
 
-  virtual void onMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total, std::vector<MessageTriggeredAction> messageTriggeredActions)
+  // the handler has already (re)subscribed the actions' topics
+  virtual void onConnect(bool sessionPresent)
   {
-    std::string payloadStr;
-    if (len > 0)
+    Serial.printf("Connected to MQTT%s.\n", sessionPresent ? ", session present" : "");
+  }
+
+  virtual void onMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+  {
+    // a payload larger than what the client received at once comes in
+    // fragments at offset index of total bytes; they are put together in a
+    // copy, which also null-terminates it, and dispatched once complete
+    if (total > COMMUNICATION_MAX_PAYLOAD_LEN)
+    {
+      if (index == 0)
+      {
+        Serial.printf("Payload of %d bytes on MQTT topic %s is too long, ignored.\n", total, topic);
+      }
+      return;
+    }
+    if (index == 0)
     {
-      payloadStr.append(payload);
-      payloadStr = payloadStr.substr(0, len);
+      _payloadLength = 0;
     }
+    if (index != _payloadLength)
+    {
+      if (_payloadLength <= total)
+      {
+        Serial.printf("Payload on MQTT topic %s is missing bytes %d to %d, ignored.\n", topic, _payloadLength, index);
+      }
+      _payloadLength = total + 1; // the rest of this message is dropped quietly
+      return;
+    }
+    memcpy(_payload + index, payload, len);
+    _payloadLength += len;
+    if (_payloadLength < total)
+    {
+      return;
+    }
+    _payload[total] = '\0';
+    len = total;
 
-    Serial.printf("Received message from MQTT topic %s with payload: %s\n", topic, payloadStr.c_str());
-    if (messageTriggeredActions.size() > 0)
+    Serial.printf("Received message from MQTT topic %s with payload: %s\n", topic, _payload);
+    TopicId id = topics.find(topic);
+    for (uint8_t i = 0; i < _actionCount && id != TopicNone; i++)
     {
-      for (auto action : messageTriggeredActions)
+      if (_actions[i].topic == id)
       {
-        if (strcmp(action.topic.c_str(), topic) == 0)
-        {
-          action.fn(payloadStr);
-        }
+        _actions[i].fn(_payload, len);
       }
     }
+    _rules.onMessage(topic, _payload);
   }
 };
 
 // ------------------------------ TemperatureSensorCommunicationManager ------------------------------
 struct TempSensorCommunicationManager : CommunicationManager
 {
-  String _topic;
+  TopicId _topic;
 
-  void init(MqttHandler *mqttHandler, String topic = MQTT_TOPIC_SENSOR_TEMPERATURE, std::vector<MessageTriggeredAction> actions = {})
+  void init(MqttHandler *mqttHandler, TopicId topic = TopicTemperature, std::initializer_list<MessageTriggeredAction> actions = {})
   {
     _topic = topic;
     CommunicationManager::init(mqttHandler, actions);
   }
 
-  void publishTemperature(String payload)
+  // rules see the reading even when the broker cannot be reached
+  void publishTemperature(const char *payload)
   {
+#ifdef MQTT_AGGREGATE_STATE
+    deviceState.setSection("temperature", payload);
+#else
     _mqttHandler->publishPayload(_topic, payload);
+#endif
+    _rules.onSensorPayload(payload);
   }
 };
 
 struct AirQualitySensorCommunicationManager : CommunicationManager
 {
-  String _topic;
+  TopicId _topic;
 
   void init(
       MqttHandler *mqttHandler,
-      String topic = MQTT_TOPIC_SENSOR_AQI,
-      std::vector<MessageTriggeredAction> messageTriggeredActions = {})
+      TopicId topic = TopicAirQuality,
+      std::initializer_list<MessageTriggeredAction> messageTriggeredActions = {})
   {
     _topic = topic;
     CommunicationManager::init(mqttHandler, messageTriggeredActions);
   }
 
-  void publishAirQuality(String payload)
+  void publishAirQuality(const char *payload)
   {
+#ifdef MQTT_AGGREGATE_STATE
+    deviceState.setSection("air_quality", payload);
+#else
     _mqttHandler->publishPayload(_topic, payload);
+#endif
+    _rules.onSensorPayload(payload);
   }
 };
 
@@ -115,70 +183,154 @@ struct SoundPlayerCommunicationManager : TempSensorCommunicationManager
 {
   void init(
       MqttHandler *mqttHandler,
-      String topic,
-      MessageTriggeredActionFn volumeChangeRequestCallback,
-      MessageTriggeredActionFn stateChangeRequestCallback,
-      MessageTriggeredActionFn genreChangeRequestCallback)
+      const MessageTriggeredActionFn &volumeChangeRequestCallback,
+      const MessageTriggeredActionFn &stateChangeRequestCallback,
+      const MessageTriggeredActionFn &genreChangeRequestCallback)
   {
-    std::vector<MessageTriggeredAction> actions{
-        MessageTriggeredAction(spConfig.MqttTopicChangeState, stateChangeRequestCallback, 1),
-        MessageTriggeredAction(spConfig.MqttTopicChangeVol, volumeChangeRequestCallback, 1),
-        MessageTriggeredAction(spConfig.MqttTopicChangeGenre, genreChangeRequestCallback, 1)};
-
-    TempSensorCommunicationManager::init(mqttHandler, topic, actions);
+    TempSensorCommunicationManager::init(
+        mqttHandler,
+        TopicTemperature,
+        {MessageTriggeredAction(TopicChangeState, stateChangeRequestCallback),
+         MessageTriggeredAction(TopicChangeVolume, volumeChangeRequestCallback),
+         MessageTriggeredAction(TopicChangeGenre, genreChangeRequestCallback)});
   }
 
-  void publishState(String payload)
+  // the genre menu on the state topic and each field on <delta topic>/<field>,
+  // all retained, so a new subscriber starts from the current values
+  uint16_t publishState(const char *field, const char *payload, size_t length)
   {
-    _mqttHandler->publishPayload(spConfig.MqttTopicStateChanged, payload);
+    if (field == NULL)
+    {
+      return _mqttHandler->publishPayload(TopicState, (const uint8_t *)payload, length, true);
+    }
+
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/%s", topics.get(TopicStateDelta), field);
+    return _mqttHandler->publishPayload(topic, (const uint8_t *)payload, length, topics.qos(TopicStateDelta), true);
   }
 };
 
 // ------------------------------ SprinklerCommunicationManager ------------------------------
+// the watering schedule on TopicSchedule is best published retained, so every sync picks it up
 struct SprinklerCommunicationManager : TempSensorCommunicationManager
 {
-  SprinklerConfig config;
-
   void init(MqttHandler *mqttHandler,
-            String topic,
-            MessageTriggeredActionFn waterRequestCallback,
-            MessageTriggeredActionFn fanRequestCallback)
+            const MessageTriggeredActionFn &waterRequestCallback,
+            const MessageTriggeredActionFn &fanRequestCallback,
+            const MessageTriggeredActionFn &scheduleRequestCallback)
   {
-    std::vector<MessageTriggeredAction> actions{
-        MessageTriggeredAction(config.MqttTopicWater, waterRequestCallback, 1),
-        MessageTriggeredAction(config.MqttTopicFan, fanRequestCallback, 1)};
-
-    TempSensorCommunicationManager::init(mqttHandler, topic, actions);
+    TempSensorCommunicationManager::init(
+        mqttHandler,
+        TopicTemperature,
+        {MessageTriggeredAction(TopicWater, waterRequestCallback),
+         MessageTriggeredAction(TopicFan, fanRequestCallback),
+         MessageTriggeredAction(TopicSchedule, scheduleRequestCallback)});
   }
-  void publishState(String item, String state)
+  void publishState(const char *item, const char *state)
   {
-    DynamicJsonDocument doc(64);
-    doc["item"] = item.c_str();
-    doc["state"] = state.c_str();
-    String payload;
-    serializeJson(doc, payload);
+#ifdef MQTT_AGGREGATE_STATE
+    deviceState.setState(item, state);
+#else
+    StaticJsonDocument<64> doc;
+    doc["item"] = item;
+    doc["state"] = state;
+    char payload[64];
+    size_t length = serializeJson(doc, payload);
 
-    _mqttHandler->publishPayload(config.MqttTopicStateChanged, payload);
+    _mqttHandler->publishPayload(TopicState, (const uint8_t *)payload, length);
+#endif
   }
 };
 
+#ifndef CAM_MQTT_CHUNK_SIZE
+#define CAM_MQTT_CHUNK_SIZE 4096
+#endif
+
+#define CAM_MQTT_CHUNK_TIMEOUT_MS 5000
+
 struct CamStreamCommunicationManager : TempSensorCommunicationManager
 {
   void init(MqttHandler *mqttHandler,
-            CamStreamConfig &config,
-            MessageTriggeredActionFn restartRequestCallack,
-            MessageTriggeredActionFn pictureRequestCallack)
+            const MessageTriggeredActionFn &restartRequestCallack,
+            const MessageTriggeredActionFn &pictureRequestCallack,
+            const MessageTriggeredActionFn &profileRequestCallback)
   {
-    std::vector<MessageTriggeredAction> actions{
-        MessageTriggeredAction(config.MqttTopicRestart, restartRequestCallack),
-        MessageTriggeredAction(config.MqttTopicPicture, pictureRequestCallack),
-    };
-
     TempSensorCommunicationManager::init(
         mqttHandler,
-        config.MqttTopicSensorTemperature,
-        actions);
+        TopicTemperature,
+        {MessageTriggeredAction(TopicRestart, restartRequestCallack),
+         MessageTriggeredAction(TopicPicture, pictureRequestCallack),
+         MessageTriggeredAction(TopicProfile, profileRequestCallback)});
+  }
+
+  void publishMotion(uint16_t changedBlocks)
+  {
+    StaticJsonDocument<64> doc;
+    doc["blocks"] = changedBlocks;
+    doc["time"] = (uint32_t)time(NULL);
+    char payload[64];
+    size_t length = serializeJson(doc, payload);
+
+    _mqttHandler->publishPayload(TopicMotion, (const uint8_t *)payload, length);
+  }
+
+#ifdef ESP32
+  // sends the JPEG in chunks small enough for the client's send buffer, then
+  // the manifest, waiting for it to drain whenever one does not fit; false if
+  // any of them could not be sent. Must not be called from the MQTT client's
+  // own callbacks
+  bool publishPicture(const uint8_t *jpeg, size_t len, uint32_t id)
+  {
+    char topic[128];
+    uint32_t chunks = (len + CAM_MQTT_CHUNK_SIZE - 1) / CAM_MQTT_CHUNK_SIZE;
+
+    for (uint32_t i = 0; i < chunks; i++)
+    {
+      size_t offset = i * CAM_MQTT_CHUNK_SIZE;
+      size_t chunkLen = min((size_t)CAM_MQTT_CHUNK_SIZE, len - offset);
+      snprintf(topic, sizeof(topic), "%s/chunk/%u", topics.get(TopicPictureData), (unsigned)i);
+
+      if (!publishWhenBufferDrains(topic, jpeg + offset, chunkLen))
+      {
+        Serial.printf("Picture %u aborted at chunk %u of %u.\n", (unsigned)id, (unsigned)i, (unsigned)chunks);
+        return false;
+      }
+    }
+
+    StaticJsonDocument<128> doc;
+    doc["id"] = id;
+    doc["size"] = len;
+    doc["chunks"] = chunks;
+    doc["chunk_size"] = CAM_MQTT_CHUNK_SIZE;
+    doc["crc32"] = crc32_le(0, jpeg, len);
+    char payload[128];
+    size_t length = serializeJson(doc, payload);
+
+    snprintf(topic, sizeof(topic), "%s/manifest", topics.get(TopicPictureData));
+    if (!publishWhenBufferDrains(topic, (const uint8_t *)payload, length))
+    {
+      // without the manifest the chunks cannot be put together
+      Serial.printf("Picture %u aborted at its manifest.\n", (unsigned)id);
+      return false;
+    }
+    return true;
+  }
+
+  // false once the connection dropped or the buffer did not drain in time
+  bool publishWhenBufferDrains(const char *topic, const uint8_t *payload, size_t length)
+  {
+    unsigned long tStart = millis();
+    while (_mqttHandler->publishPayload(topic, payload, length) == 0)
+    {
+      if (!_mqttHandler->isConnected() || millis() - tStart > CAM_MQTT_CHUNK_TIMEOUT_MS)
+      {
+        return false;
+      }
+      delay(10);
+    }
+    return true;
   }
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef DELEGATE_H
+#define DELEGATE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+// room for a function pointer or a lambda capturing a couple of pointers
+#ifndef DELEGATE_CAPACITY
+#define DELEGATE_CAPACITY (2 * sizeof(void *))
+#endif
+
+template <typename Signature, size_t Capacity = DELEGATE_CAPACITY>
+struct Delegate;
+
+// a callback stored inline, so creating, copying and calling one never
+// allocates; only plain callables fit, capturing anything that owns memory
+// (a String, a vector, a std::function) is a compile error
+template <typename R, typename... Args, size_t Capacity>
+struct Delegate<R(Args...), Capacity>
+{
+  alignas(void *) unsigned char _storage[Capacity];
+  R (*_invoke)(const void *, Args...) = nullptr;
+
+  Delegate() {}
+  Delegate(decltype(nullptr)) {}
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+  Delegate(F fn)
+  {
+    static_assert(sizeof(F) <= Capacity, "callback captures too much for a Delegate");
+    static_assert(alignof(F) <= alignof(void *), "callback is over-aligned for a Delegate");
+    static_assert(std::is_trivially_copyable<F>::value && std::is_trivially_destructible<F>::value,
+                  "a Delegate can only capture pointers and plain values");
+
+    memcpy(_storage, &fn, sizeof(F));
+    _invoke = [](const void *storage, Args... args) -> R
+    { return (*(const F *)storage)(std::forward<Args>(args)...); };
+  }
+
+  R operator()(Args... args) const
+  {
+    return _invoke(_storage, std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const { return _invoke != nullptr; }
+  bool operator==(decltype(nullptr)) const { return _invoke == nullptr; }
+  bool operator!=(decltype(nullptr)) const { return _invoke != nullptr; }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef DEVICESTATE_H
+#define DEVICESTATE_H
+
+#include <Arduino.h>
+#include "MqttHandler.h"
+
+// with MQTT_AGGREGATE_STATE defined, sensor readings and item states are not
+// published one by one but collected into a single document on TopicDevice,
+// sent once per cycle, e.g.
+//   {"temperature":{...},"air_quality":{...},"states":{"fan":"off"},"uptime":12,"rssi":-61}
+// Home Assistant picks the values out with value templates
+
+#define DEVICE_STATE_MAX_SECTIONS 2
+#define DEVICE_STATE_SECTION_MAX_LEN 160
+#define DEVICE_STATE_MAX_ITEMS 6
+#define DEVICE_STATE_MAX_LEN 512
+
+struct DeviceStateSection
+{
+  const char *name = nullptr;
+  char json[DEVICE_STATE_SECTION_MAX_LEN];
+};
+
+// names and states are not copied, they are literals or live as long as the device
+struct DeviceStateItem
+{
+  const char *name = nullptr;
+  const char *state = nullptr;
+};
+
+struct DeviceState
+{
+  DeviceStateSection _sections[DEVICE_STATE_MAX_SECTIONS];
+  DeviceStateItem _items[DEVICE_STATE_MAX_ITEMS];
+
+  // a JSON object, replacing the section of the same name
+  void setSection(const char *name, const char *json);
+  void setState(const char *name, const char *state);
+  // sends what was collected this cycle, then starts the next one with the
+  // item states kept; does nothing unless MQTT_AGGREGATE_STATE is defined
+  uint16_t publish(MqttHandler *);
+};
+
+extern DeviceState deviceState;
+
+#endif
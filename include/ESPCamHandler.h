@@ -3,6 +3,9 @@
 
 #include "String"
 #include <OV2640.h>
+#include "FrameBroker.h"
+#include "SnapshotWriter.h"
+#include "CamProfile.h"
 
 #define PWDN_GPIO_NUM 32
 #define RESET_GPIO_NUM -1
@@ -28,6 +31,10 @@ struct ESPCamHandler
   void init();
   void takePicAndSave();
   OV2640 *getCam();
+  void startCapture();
+  FrameBroker *getFrameBroker();
+  SnapshotWriter *getSnapshotWriter();
+  CamQualityController *getQualityController();
 };
 
 #endif
\ No newline at end of file
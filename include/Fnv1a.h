@@ -0,0 +1,29 @@
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FNV1A_OFFSET_BASIS 2166136261u
+#define FNV1A_PRIME 16777619u
+
+// 32 bit FNV-1a, the hash of topics, rule signals, library paths and published
+// payloads; passing a previous hash as h continues it, so several parts hash as one
+
+// of a null-terminated string, at compile time for constant ones
+constexpr uint32_t fnv1a(const char *text, uint32_t h = FNV1A_OFFSET_BASIS)
+{
+  return *text == '\0' ? h : fnv1a(text + 1, (h ^ (uint8_t)*text) * FNV1A_PRIME);
+}
+
+inline uint32_t fnv1aBytes(const void *data, size_t length, uint32_t h = FNV1A_OFFSET_BASIS)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    h = (h ^ bytes[i]) * FNV1A_PRIME;
+  }
+  return h;
+}
+
+#endif
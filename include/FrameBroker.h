@@ -0,0 +1,54 @@
+#ifndef FRAMEBROKER_H
+#define FRAMEBROKER_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// frames that can be referenced at the same time, including the latest one
+#define CAM_FRAME_POOL_SIZE 4
+
+// a captured JPEG in a PSRAM pool buffer; consumers hold a reference while
+// they read it and the buffer is only reused once the last one is released
+struct CamFrame
+{
+  uint8_t *buf = nullptr;
+  size_t len = 0;
+  size_t capacity = 0;
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint32_t seq = 0;
+  unsigned long capturedMs = 0;
+  uint8_t refs = 0;
+};
+
+// the one place frames are captured; each capture is copied once from the
+// driver buffer into the pool and handed straight back, so the driver never
+// waits for a slow consumer and consumers never see a buffer being overwritten
+struct FrameBroker
+{
+  CamFrame _frames[CAM_FRAME_POOL_SIZE];
+  int _latest = -1;
+  uint32_t _seq = 0;
+  int _consumers = 0;
+  uint32_t _dropped = 0;
+  uint32_t _frameMs = 0; // smoothed time between captures while capturing continuously
+  unsigned long _lastCaptureMs = 0;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+  TaskHandle_t _captureTask = NULL;
+
+  void begin();
+  void captureLoop();
+
+  // captures continuously while at least one consumer is registered
+  void addConsumer();
+  void removeConsumer();
+
+  // newest frame captured after `afterSeq`, or nullptr if there is none yet
+  CamFrame *acquire(uint32_t afterSeq = 0);
+  // blocks the calling task until a frame newer than `afterSeq` is captured
+  CamFrame *waitFor(uint32_t afterSeq, uint32_t timeoutMs);
+  void release(CamFrame *);
+  uint32_t latestSeq();
+};
+
+#endif
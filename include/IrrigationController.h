@@ -0,0 +1,59 @@
+#ifndef IRRIGATIONCONTROLLER_H
+#define IRRIGATIONCONTROLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define IRRIGATION_GAIN_SHIFT 8 // controller gains are Q8
+
+// per installation calibration; moisture is in permille of the range between
+// the dry and the wet reading of the soil probe
+struct IrrigationConfig
+{
+  uint16_t dryRaw = 850; // ADC reading in dry soil, capacitive probes read lower when wet
+  uint16_t wetRaw = 400;
+  uint16_t setpointPermille = 400;
+  uint16_t deadbandPermille = 20;
+  int16_t kp = 256;  // Q8, permille of moisture to add per permille of error
+  int16_t ki = 8;    // Q8, per permille hour of accumulated error
+  uint16_t rootDepthMm = 200;
+  uint16_t pumpSecondsPerPermille = 384; // Q8, measured by watering a dry bed once
+  uint16_t maxRunSec = 600;
+  uint16_t maxDutyPermille = 50; // share of the time between decisions the pump may run
+};
+
+// what a decision leaves behind for the next one; small enough for RTC memory
+struct IrrigationState
+{
+  int32_t integral = 0; // permille hours
+  uint32_t lastEpoch = 0;
+};
+
+struct IrrigationInputs
+{
+  uint16_t soilRaw;
+  int16_t temperatureCentiC;
+  uint16_t humidityPermille;
+  uint32_t pressurePa;
+};
+
+struct IrrigationDecision
+{
+  uint16_t runSec;
+  int16_t moisturePermille;
+  uint16_t etCentiMmPerDay; // reference evapotranspiration estimate
+};
+
+// PI control of soil moisture with the expected evaporation until the next
+// decision fed forward; integer only, and free of Arduino so it can run on the
+// host against a simulated bed
+struct IrrigationController
+{
+  IrrigationConfig _config;
+
+  int16_t toMoisture(uint16_t soilRaw);
+  uint16_t estimateEt(int16_t temperatureCentiC, uint16_t humidityPermille, uint32_t pressurePa);
+  IrrigationDecision decide(const IrrigationInputs &, IrrigationState &, uint32_t epoch);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include <list>
+#include "TrackMetadata.h"
+
+#define LIBRARY_INDEX_DIR "/.library"
+#define LIBRARY_GAIN_INDEX_PATH LIBRARY_INDEX_DIR "/gain.idx"
+#define LIBRARY_METADATA_INDEX_PATH LIBRARY_INDEX_DIR "/meta.idx"
+
+// normalization gain of a track, keyed by the hash of its path
+struct TrackGain
+{
+  uint32_t pathHash;
+  int16_t gainCentiDb;
+};
+
+// where the metadata of a track is in the metadata index file
+struct TrackRecord
+{
+  uint32_t pathHash;
+  uint32_t index;
+};
+
+// per-track data cached on the card next to the music, so it is only
+// computed once per track
+struct LibraryIndex
+{
+  fs::FS *_fs = nullptr;
+  std::vector<TrackGain> _gains;     // sorted by path hash
+  std::vector<TrackRecord> _records; // sorted by path hash
+  uint32_t _recordCount = 0;         // records in the file, superseded ones included
+
+  void load(fs::FS &);
+  bool findGain(const String &path, int16_t &gainCentiDb);
+  void storeGain(const String &path, int16_t gainCentiDb);
+
+  // reads the tags of the tracks that are not indexed yet, returns how many were
+  size_t indexMetadata(const std::list<String> &paths);
+  // one record read, no tag parsing
+  bool findMetadata(const String &path, TrackMetadata &);
+
+  void loadMetadata();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MOTIONDETECTOR_H
+#define MOTIONDETECTOR_H
+
+#include <Arduino.h>
+#include "FrameBroker.h"
+#include "SnapshotWriter.h"
+#include "MotionModel.h"
+
+#ifndef CAM_MOTION_INTERVAL_MS
+#define CAM_MOTION_INTERVAL_MS 500
+#endif
+// mean per pixel difference for a block to count as changed, and how many
+// changed blocks make motion
+#ifndef CAM_MOTION_PIXEL_THRESHOLD
+#define CAM_MOTION_PIXEL_THRESHOLD 20
+#endif
+#ifndef CAM_MOTION_MIN_BLOCKS
+#define CAM_MOTION_MIN_BLOCKS 3
+#endif
+#ifndef CAM_MOTION_BURST
+#define CAM_MOTION_BURST 3
+#endif
+#ifndef CAM_MOTION_COOLDOWN_MS
+#define CAM_MOTION_COOLDOWN_MS 10000
+#endif
+
+typedef std::function<void(uint16_t changedBlocks)> OnMotionCallback;
+
+// samples a frame every interval, decodes it at 1/8 scale into a small
+// grayscale image and compares it with the running background; on motion it
+// queues a burst of full resolution snapshots and reports the event
+struct MotionDetector
+{
+  FrameBroker *_frameBroker;
+  SnapshotWriter *_snapshotWriter;
+  OnMotionCallback _onMotion;
+  MotionModel _model;
+  uint8_t *_rgb = nullptr;
+  uint8_t *_luma = nullptr;
+  size_t _rgbCapacity = 0;
+  unsigned long _lastMotionMs = 0;
+
+  void begin(FrameBroker *, SnapshotWriter *, OnMotionCallback);
+  void loop();
+  bool toLuma(CamFrame *, uint16_t &width, uint16_t &height);
+};
+
+#endif
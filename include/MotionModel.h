@@ -0,0 +1,26 @@
+#ifndef MOTIONMODEL_H
+#define MOTIONMODEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MOTION_BLOCK_SIZE 8
+#define MOTION_BG_SHIFT 8  // background is kept in Q8
+#define MOTION_BG_RATE 4   // the background follows the scene by 1/16 per sample
+
+// running background of a small grayscale image, compared block by block;
+// all integer math, so it is cheap enough to run on every sampled frame
+struct MotionModel
+{
+  uint16_t _stride = 0;
+  uint16_t _width = 0; // cropped to whole blocks
+  uint16_t _height = 0;
+  uint16_t *_background = nullptr;
+  bool _primed = false;
+
+  bool init(uint16_t width, uint16_t height);
+  // number of blocks whose mean absolute difference to the background is above the threshold
+  uint16_t update(const uint8_t *luma, uint8_t threshold);
+};
+
+#endif
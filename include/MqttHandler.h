@@ -3,20 +3,67 @@
 
 #include <AsyncMqttClient.h>
 #include "Config.h"
+#include "Delegate.h"
+#include "Topics.h"
 
-typedef std::function<void(char *, char *, AsyncMqttClientMessageProperties, size_t, size_t, size_t)> OnMessageCallback;
-typedef std::function<void(bool)> OnConnectCallback;
+typedef Delegate<void(char *, char *, AsyncMqttClientMessageProperties, size_t, size_t, size_t)> OnMessageCallback;
+typedef Delegate<void(bool)> OnConnectCallback;
+// called once the broker acknowledged the publish, or with delivered = false
+// if the connection dropped first; QoS 0 publishes complete once queued
+typedef Delegate<void(uint16_t packetId, bool delivered)> OnPublishedCallback;
+// called once every subscription was acknowledged after connecting, or right
+// away when the broker still holds them from the last session
+typedef Delegate<void(bool allGranted)> OnSubscriptionsReadyCallback;
+
+// QoS 1/2 publishes that can wait for their acknowledgement at the same time
+#define MQTT_MAX_PENDING_PUBLISHES 8
+#define MQTT_MAX_SUBSCRIPTIONS 12
+// e.g. one per communication manager sharing the handler
+#define MQTT_MAX_LISTENERS 4
+
+#define MQTT_SUBACK_PENDING 0xFF
+#define MQTT_SUBACK_FAILURE 0x80
+
+// a topic filter the handler keeps subscribed; the topic is not copied
+struct Subscription
+{
+  const char *topic = nullptr;
+  uint8_t qos = 0;
+  bool renew = false; // for retained state only held in RAM, sent on every connect
+  uint16_t packetId = 0;
+  uint8_t grantedQos = MQTT_SUBACK_PENDING;
+};
 
 struct MqttHandler
 {
-  void init(MqttConfig &);
+  // also expands the device's topics under the given prefix, by default
+  // MQTT_TOPIC_PREFIX/<client id>; the client id is derived from the chip id,
+  // so devices flashed from one env get topics of their own. False if the
+  // topics could not be set up, and then the handler must not be used
+  bool init(MqttConfig &, const char *topicPrefix = nullptr);
   void connect();
   void disconnect();
   bool isConnected();
+  // a one-off subscription, not renewed on reconnect
   void subscribe(const char *topic, uint8_t qos = 0);
-  void publishPayload(String topic, String payload, bool retain = false);
-  void onMessage(OnMessageCallback);
-  void onConnect(OnConnectCallback);
+  // kept for every connection; with a persistent session they are only sent
+  // again when the broker lost the session or the set changed
+  bool addSubscription(const char *topic, uint8_t qos = 0, bool renew = false);
+  bool addSubscription(TopicId, bool renew = false);
+  bool subscriptionsReady();
+  void onSubscriptionsReady(const OnSubscriptionsReadyCallback &);
+  // the payload is sent as is, so it may be binary; returns the packet id
+  // (1 for QoS 0), or 0 if it could not be queued, e.g. while the client's
+  // send buffer has no room for it
+  uint16_t publishPayload(const char *topic, const uint8_t *payload, size_t length, uint8_t qos = 0, bool retain = false, const OnPublishedCallback &onPublished = nullptr);
+  uint16_t publishPayload(const char *topic, const char *payload, uint8_t qos = 0, bool retain = false, const OnPublishedCallback &onPublished = nullptr);
+  // with the QoS of the topic table
+  uint16_t publishPayload(TopicId, const uint8_t *payload, size_t length, bool retain = false, const OnPublishedCallback &onPublished = nullptr);
+  uint16_t publishPayload(TopicId, const char *payload, bool retain = false, const OnPublishedCallback &onPublished = nullptr);
+  // every registered listener is called, in the order they were added; false
+  // once MQTT_MAX_LISTENERS are registered
+  bool onMessage(const OnMessageCallback &);
+  bool onConnect(const OnConnectCallback &);
 };
 
 #endif
\ No newline at end of file
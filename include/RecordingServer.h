@@ -0,0 +1,22 @@
+#ifndef RECORDINGSERVER_H
+#define RECORDINGSERVER_H
+
+#include <ESPAsyncWebServer.h>
+
+// downloads running at the same time, each holds a read-ahead buffer
+#ifndef CAM_MAX_DOWNLOADS
+#define CAM_MAX_DOWNLOADS 2
+#endif
+
+namespace audp
+{
+  // serves what the snapshot writer saved on the SD card:
+  //   /sd/list?dir=/20240101&offset=0&limit=50  paginated JSON directory listing
+  //   /sd/<path>                                the file, with Range, ETag and Last-Modified
+  struct RecordingServer
+  {
+    void begin(AsyncWebServer &);
+  };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef RTSPSTREAMER_H
+#define RTSPSTREAMER_H
+
+#include "ESPCamHandler.h"
+#include <WiFi.h>
+#include <CStreamer.h>
+
+#ifndef CAM_RTSP_PORT
+#define CAM_RTSP_PORT 8554
+#endif
+
+#ifndef CAM_RTSP_FPS
+#define CAM_RTSP_FPS 10
+#endif
+
+namespace audp
+{
+  // feeds Micro-RTSP sessions from the shared capture instead of capturing
+  // a frame of its own for every packetized image; CStreamer keeps the frame
+  // size it was built with private, so a frame of another size is not sent
+  // but reported in _resizedWidth/_resizedHeight for a new streamer to be built
+  struct SharedFrameStreamer : CStreamer
+  {
+    ESPCamHandler *_camHandler;
+    uint32_t _lastSeq = 0;
+    u_short _width;
+    u_short _height;
+    u_short _resizedWidth = 0;
+    u_short _resizedHeight = 0;
+
+    SharedFrameStreamer(ESPCamHandler *camHandler, u_short width, u_short height);
+    void streamImage(uint32_t curMsec);
+  };
+
+  // RTSP with RTP over UDP or TCP, run in its own task; all sessions get the
+  // same frames, paced to the configured fps
+  struct RtspStreamer
+  {
+    ESPCamHandler *_camHandler;
+    WiFiServer *_server;
+    SharedFrameStreamer *_streamer;
+    uint32_t _msPerFrame;
+    bool _consuming = false;
+
+    void begin(ESPCamHandler *camHandler, uint16_t port = CAM_RTSP_PORT, uint8_t fps = CAM_RTSP_FPS);
+    void loop();
+    void recreateStreamer(u_short width, u_short height);
+  };
+}
+
+#endif
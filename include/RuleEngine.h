@@ -0,0 +1,74 @@
+#ifndef RULEENGINE_H
+#define RULEENGINE_H
+
+#include <Arduino.h>
+#include "Delegate.h"
+#include "Fnv1a.h"
+
+#define RULE_MAX_RULES 16
+#define RULE_MAX_ACTIONS 8
+#define RULE_PAYLOAD_MAX_LEN 16
+
+// the payload is also null-terminated, and only valid during the call
+typedef Delegate<void(const char *payload, size_t length)> MessageTriggeredActionFn;
+typedef Delegate<void(const char *topic)> OnRuleTopic;
+
+enum RuleOp : uint8_t
+{
+  RuleGreater,
+  RuleGreaterOrEqual,
+  RuleLess,
+  RuleLessOrEqual,
+  RuleEqual,
+  RuleNotEqual
+};
+
+// one compiled rule; signals and actions are referred to by hash and index,
+// so evaluating never touches a string
+struct Rule
+{
+  uint32_t signal;
+  int32_t threshold; // x100
+  RuleOp op;
+  uint8_t action;
+  bool active; // fires on the transition to true only
+  char payload[RULE_PAYLOAD_MAX_LEN];
+};
+
+struct RuleAction
+{
+  uint32_t topicHash;
+  MessageTriggeredActionFn fn;
+};
+
+// local automations, delivered on TopicRules (best retained, so they come
+// back on every connect) and compiled from a definition such as
+//   temperature_f > 85 => home/sprinkler/esp32-a4cf12b3c4d5/fan:300; aqi >= 4 => home/sprinkler/esp32-a4cf12b3c4d5/water:60
+// signals are the fields of the node's sensor payloads and, when they contain a
+// '/', the topics of messages it receives; an action is the topic of one of the node's own
+// message triggered actions, which is called right away with the payload.
+// Rules are compiled and message signals evaluated on the MQTT task while
+// sensor signals are evaluated on the loop task, so the rules are only touched
+// under _mux; actions are added before connecting and called outside of it
+struct RuleEngine
+{
+  Rule _rules[RULE_MAX_RULES];
+  uint8_t _ruleCount = 0;
+  RuleAction _actions[RULE_MAX_ACTIONS];
+  uint8_t _actionCount = 0;
+#ifdef ESP32
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+  void addAction(const char *topic, const MessageTriggeredActionFn &fn);
+  // the topics used as signals are handed to onTopic so they can be subscribed to
+  bool compile(const char *definition, const OnRuleTopic &onTopic = nullptr);
+
+  void evaluate(uint32_t signal, float value);
+  // every numeric field of a JSON sensor payload is a signal
+  void onSensorPayload(const char *payload);
+  // numbers, and "on"/"off" as 1/0
+  void onMessage(const char *topic, const char *payload);
+};
+
+#endif
@@ -10,118 +10,61 @@
 #include "ens210.h"
 #include <DHT.h>
 #include "MQ135.h"
-#include <list>
 #include "Config.h"
 #include "CommunicationManager.h"
 
-enum SensorCategory
-{
-  Unknown,
-  Temperature,
-  AirQuality
-};
-
-enum TemperatureSensorType
-{
-  NoopTempSensor,
-  DHT11Sensor,
-  BME280Sensor,
-  AHT21,
-  Type_ENS210
-};
-
-enum AirQualitySensorType
-{
-  NoSensor,
-  ENS160,
-  Type_MQ135
-};
-
 struct TemperatureSensorConfig
 {
-  TemperatureSensorType type;
-  uint16_t DHTPin;
-  uint16_t SCLPin;
-  uint16_t SDAPin;
-
-  TemperatureSensorConfig() : TemperatureSensorConfig(NoopTempSensor){};
-
-  TemperatureSensorConfig(
-      TemperatureSensorType type,
-      uint16_t DHTPin = DHTPIN,
-      uint16_t SCLPin = SCL, // default SCL on a ESP8266 is 5
-      uint16_t SDAPin = SDA) // default SDA on a ESP8266 is 4
-  {
-    this->type = type;
-    this->DHTPin = DHTPin;
-    this->SCLPin = SCLPin;
-    this->SDAPin = SDAPin;
-  }
+  uint16_t DHTPin = DHTPIN;
+  uint16_t SCLPin = SCL; // default SCL on a ESP8266 is 5
+  uint16_t SDAPin = SDA; // default SDA on a ESP8266 is 4
 };
 
 struct AirQualitySensorConfig
 {
-  AirQualitySensorType type;
-  String location;
-  uint16_t SCLPin;
-  uint16_t SDAPin;
-
-  AirQualitySensorConfig() : AirQualitySensorConfig(NoSensor){};
-
-  AirQualitySensorConfig(
-      AirQualitySensorType type,
-      String location = LOCATION_TEST,
-      uint16_t SCLPin = SCL, // default SCL on a ESP8266 is 5
-      uint16_t SDAPin = SDA) // default SDA on a ESP8266 is 4)
-  {
-    this->type = type;
-    this->location = location;
-    this->SCLPin = SCLPin;
-    this->SDAPin = SDAPin;
-  }
+  String location = LOCATION_TEST;
+  uint16_t SCLPin = SCL; // default SCL on a ESP8266 is 5
+  uint16_t SDAPin = SDA; // default SDA on a ESP8266 is 4
 };
 
-struct Sensor
-{
-  virtual String createPayload() { return ""; };
+// every sensor payload fits, so it is serialized on the stack
+#define SENSOR_PAYLOAD_MAX_LEN 160
 
-  virtual SensorCategory getCategory() { return Unknown; }
-};
-
-struct TemperatureSensor : Sensor
+// the sensor bases name the concrete sensor as Derived and call its readings
+// directly; a reading Derived does not define falls back to the base's, and
+// no sensor has a vtable
+template <class Derived>
+struct TemperatureSensor
 {
+  Derived *derived() { return static_cast<Derived *>(this); }
 
-  TemperatureSensor() {}
-
-  virtual float readTemperature() { return 0; }
+  float readTemperatureF() { return derived()->readTemperature() * 1.8 + 32; };
 
-  virtual float readTemperatureF() { return readTemperature() * 1.8 + 32; };
+  float readHumidity() { return 0; };
 
-  virtual float readHumidity() { return 0; };
+  float readPressure() { return 0; };
 
-  virtual float readPressure() { return 0; };
+  float readAltitude() { return 0; };
 
-  virtual float readAltitude() { return 0; };
-
-  String createPayload()
+  // writes the JSON payload and returns its length
+  size_t createPayload(char *payload, size_t maxLen)
   {
-    DynamicJsonDocument doc(128);
-    doc["temperature_f"] = this->readTemperatureF();
-    doc["humidity"] = this->readHumidity();
-    doc["pressure"] = this->readPressure();
-    doc["altitude"] = this->readAltitude();
-
-    String payload;
-    serializeJson(doc, payload);
-    return payload;
-  }
+    StaticJsonDocument<128> doc;
+    doc["temperature_f"] = derived()->readTemperatureF();
+    doc["humidity"] = derived()->readHumidity();
+    doc["pressure"] = derived()->readPressure();
+    doc["altitude"] = derived()->readAltitude();
 
-  SensorCategory getCategory() { return Temperature; }
+    return serializeJson(doc, payload, maxLen);
+  }
 };
 
-struct DHT11TemperatureSensor : TemperatureSensor
+struct DHT11TemperatureSensor final : TemperatureSensor<DHT11TemperatureSensor>
 {
   DHT *dht;
+
+  static DHT11TemperatureSensor *create(const TemperatureSensorConfig &);
+
   DHT11TemperatureSensor(DHT *dht)
   {
     this->dht = dht;
@@ -138,10 +81,12 @@ struct DHT11TemperatureSensor : TemperatureSensor
   }
 };
 
-struct BME280TemperatureSensor : TemperatureSensor
+struct BME280TemperatureSensor final : TemperatureSensor<BME280TemperatureSensor>
 {
   Adafruit_BME280 *bme;
 
+  static BME280TemperatureSensor *create(const TemperatureSensorConfig &);
+
   BME280TemperatureSensor(Adafruit_BME280 *bme)
   {
     this->bme = bme;
@@ -168,9 +113,12 @@ struct BME280TemperatureSensor : TemperatureSensor
   }
 };
 
-struct AHT21Sensor : TemperatureSensor
+struct AHT21Sensor final : TemperatureSensor<AHT21Sensor>
 {
   Adafruit_AHTX0 *aht;
+
+  static AHT21Sensor *create(const TemperatureSensorConfig &);
+
   AHT21Sensor(Adafruit_AHTX0 *aht)
   {
     this->aht = aht;
@@ -191,20 +139,23 @@ struct AHT21Sensor : TemperatureSensor
   }
 };
 
-struct ENS210Sensor : TemperatureSensor
+struct ENS210Sensor final : TemperatureSensor<ENS210Sensor>
 {
   ENS210 *ens210;
+
+  static ENS210Sensor *create(const TemperatureSensorConfig &);
+
   ENS210Sensor(ENS210 *ens210)
   {
     this->ens210 = ens210;
   }
 
-  String createPayload()
+  size_t createPayload(char *payload, size_t maxLen)
   {
     int t_data, t_status, h_data, h_status;
     ens210->measure(&t_data, &t_status, &h_data, &h_status);
 
-    DynamicJsonDocument doc(128);
+    StaticJsonDocument<128> doc;
     if (t_status == ENS210_STATUS_OK)
     {
       doc["temperature_f"] = ens210->toFahrenheit(t_data, 10) / 10.0 - 13.0;
@@ -214,13 +165,12 @@ struct ENS210Sensor : TemperatureSensor
       doc["humidity"] = ens210->toPercentageH(h_data, 1);
     }
 
-    String payload;
-    serializeJson(doc, payload);
-    return payload;
+    return serializeJson(doc, payload, maxLen);
   }
 };
 
-struct AirQualitySensor : Sensor
+template <class Derived>
+struct AirQualitySensor
 {
   String location;
 
@@ -229,17 +179,19 @@ struct AirQualitySensor : Sensor
     this->location = location;
   }
 
+  Derived *derived() { return static_cast<Derived *>(this); }
+
   /**
    * Get the air quality index
    * Return value: 1-Excellent, 2-Good, 3-Moderate, 4-Poor, 5-Unhealthy
    */
-  virtual uint8_t getAQI() { return 0; };
+  uint8_t getAQI() { return 0; };
 
   /**
    * Get TVOC concentration
    * Return value range: 0–65000, unit: ppb
    */
-  virtual uint16_t getTVOC() { return 0; };
+  uint16_t getTVOC() { return 0; };
 
   /**
    * Get CO2 equivalent concentration calculated according to the detected data of VOCs and hydrogen (eCO2 – Equivalent CO2)
@@ -247,7 +199,7 @@ struct AirQualitySensor : Sensor
    * Five levels: Excellent(400 - 600), Good(600 - 800), Moderate(800 - 1000),
    *               Poor(1000 - 1500), Unhealthy(> 1500)
    */
-  virtual uint16_t getECO2() { return 0; };
+  uint16_t getECO2() { return 0; };
 
   /**
    * Experts measure air quality using parts per million, or PPM. This indicates how many milligrams
@@ -258,31 +210,30 @@ struct AirQualitySensor : Sensor
    * AQI, to measure air pollution in a way average citizens can understand.
    *
    */
-  virtual uint16_t getAirQuality() { return 0; };
+  uint16_t getAirQuality() { return 0; };
 
   String getLocation() { return location; }
 
-  SensorCategory getCategory() { return AirQuality; }
-
-  String createPayload()
+  // writes the JSON payload and returns its length
+  size_t createPayload(char *payload, size_t maxLen)
   {
-    DynamicJsonDocument doc(128);
-    doc["location"] = this->getLocation();
-    doc["aqi"] = this->getAQI();
-    doc["tvoc"] = this->getTVOC();
-    doc["co2"] = this->getECO2();
-    doc["aq"] = this->getAirQuality();
-
-    String payload;
-    serializeJson(doc, payload);
-    return payload;
+    StaticJsonDocument<128> doc;
+    doc["location"] = this->location.c_str();
+    doc["aqi"] = derived()->getAQI();
+    doc["tvoc"] = derived()->getTVOC();
+    doc["co2"] = derived()->getECO2();
+    doc["aq"] = derived()->getAirQuality();
+
+    return serializeJson(doc, payload, maxLen);
   }
 };
 
-struct ENS160Sensor : AirQualitySensor
+struct ENS160Sensor final : AirQualitySensor<ENS160Sensor>
 {
   ScioSense_ENS160 *sensor;
 
+  static ENS160Sensor *create(const AirQualitySensorConfig &);
+
   ENS160Sensor(ScioSense_ENS160 *sensor, String location) : AirQualitySensor(location)
   {
     this->sensor = sensor;
@@ -313,18 +264,20 @@ struct ENS160Sensor : AirQualitySensor
     return this->sensor->geteCO2();
   };
 
-  String createPayload()
+  size_t createPayload(char *payload, size_t maxLen)
   {
     this->sensor->measure(true);
     this->sensor->measureRaw(true);
-    return AirQualitySensor::createPayload();
+    return AirQualitySensor::createPayload(payload, maxLen);
   }
 };
 
-struct MQ135Sensor : AirQualitySensor
+struct MQ135Sensor final : AirQualitySensor<MQ135Sensor>
 {
   MQ135 *sensor;
 
+  static MQ135Sensor *create(const AirQualitySensorConfig &);
+
   MQ135Sensor(MQ135 *sensor, String location) : AirQualitySensor(location)
   {
     this->sensor = sensor;
@@ -336,18 +289,45 @@ struct MQ135Sensor : AirQualitySensor
   };
 };
 
-TemperatureSensor *initTemperatureSensor(TemperatureSensorConfig);
-AirQualitySensor *initAirQualitySensor(AirQualitySensorConfig);
+// each sensor of the set is created from the config of its kind
+template <class S>
+const TemperatureSensorConfig &sensorConfigFor(TemperatureSensor<S> *, const TemperatureSensorConfig &tempConfig, const AirQualitySensorConfig &)
+{
+  return tempConfig;
+}
+
+template <class S>
+const AirQualitySensorConfig &sensorConfigFor(AirQualitySensor<S> *, const TemperatureSensorConfig &, const AirQualitySensorConfig &aqConfig)
+{
+  return aqConfig;
+}
+
+template <typename S>
+struct SensorSlot
+{
+  S *_sensor = nullptr;
+};
 
-struct SensorHandler
+// publishes the readings of a set of sensors fixed at compile time, e.g.
+// SensorHandler<AHT21Sensor> or SensorHandler<BME280TemperatureSensor, ENS160Sensor>;
+// only the drivers of the set are linked, and every call goes straight to
+// the sensor type
+template <typename... Sensors>
+struct SensorHandler : SensorSlot<Sensors>...
 {
-  std::list<Sensor *> _sensors;
-  TempSensorCommunicationManager *_tempCm;
-  AirQualitySensorCommunicationManager *_aqCm;
+  TempSensorCommunicationManager *_tempCm = nullptr;
+  AirQualitySensorCommunicationManager *_aqCm = nullptr;
 
-  void init(std::list<Sensor *> sensors)
+  // sensors created by the caller, a nullptr is skipped
+  void init(
+      Sensors *...sensors,
+      TempSensorCommunicationManager *tempCm = nullptr,
+      AirQualitySensorCommunicationManager *aqCm = nullptr)
   {
-    _sensors = sensors;
+    _tempCm = tempCm;
+    _aqCm = aqCm;
+    int expand[] = {0, (SensorSlot<Sensors>::_sensor = sensors, 0)...};
+    (void)expand;
   }
 
   void init(
@@ -371,36 +351,43 @@ struct SensorHandler
   {
     _tempCm = tempCm;
     _aqCm = aqCm;
+    int expand[] = {0, (SensorSlot<Sensors>::_sensor = Sensors::create(sensorConfigFor((Sensors *)nullptr, tempSensorConfig, aqSensorConfig)), 0)...};
+    (void)expand;
+  }
 
-    auto tempSensor = initTemperatureSensor(tempSensorConfig);
-    if (tempSensor != nullptr)
+  void publishAll()
+  {
+    int expand[] = {0, (publish(SensorSlot<Sensors>::_sensor), 0)...};
+    (void)expand;
+  }
+
+  template <typename S>
+  void publish(S *sensor)
+  {
+    char json[SENSOR_PAYLOAD_MAX_LEN];
+    if (sensor != nullptr && sensor->createPayload(json, sizeof(json)) > 0)
     {
-      _sensors.push_back(tempSensor);
+      publishPayload(sensor, json);
     }
+  }
 
-    auto aqSensor = initAirQualitySensor(aqSensorConfig);
-    if (aqSensor != nullptr)
+  template <typename S>
+  void publishPayload(TemperatureSensor<S> *, const char *json)
+  {
+    if (_tempCm != nullptr)
     {
-      _sensors.push_back(aqSensor);
+      _tempCm->publishTemperature(json);
     }
   }
 
-  void publishAll()
+  template <typename S>
+  void publishPayload(AirQualitySensor<S> *, const char *json)
   {
-    for (auto sensor : _sensors)
+    if (_aqCm != nullptr)
     {
-      if (sensor->getCategory() == Temperature && _tempCm != nullptr)
-      {
-        String json = sensor->createPayload();
-        _tempCm->publishTemperature(json);
-      }
-      else if (sensor->getCategory() == AirQuality && _aqCm != nullptr)
-      {
-        String json = sensor->createPayload();
-        _aqCm->publishAirQuality(json);
-      }
+      _aqCm->publishAirQuality(json);
     }
   }
 };
 
-#endif
\ No newline at end of file
+#endif
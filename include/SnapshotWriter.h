@@ -0,0 +1,52 @@
+#ifndef SNAPSHOTWRITER_H
+#define SNAPSHOTWRITER_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "FrameBroker.h"
+
+// keep at least this much of the card free, deleting the oldest snapshots
+#ifndef CAM_SD_MIN_FREE_BYTES
+#define CAM_SD_MIN_FREE_BYTES (256ULL * 1024 * 1024)
+#endif
+
+#define SNAPSHOT_QUEUE_SIZE 16
+
+// called from the writer task with the saved frame, before it is released
+typedef std::function<void(CamFrame *)> OnSnapshotCallback;
+
+struct SnapshotRequest
+{
+  uint32_t afterSeq;
+  bool publish;
+};
+
+// saves snapshots to SD_MMC from its own task; requests are queued so a burst
+// never blocks the caller, and every request gets a frame of its own
+//
+// files are named /YYYYMMDD/HHMMSS_<seq>.jpg, so sorting names sorts them by
+// time; before the clock is synced they land in /19700101
+struct SnapshotWriter
+{
+  FrameBroker *_frameBroker;
+  QueueHandle_t _queue = nullptr; // stays null when the writer could not start
+  Preferences _prefs;
+  uint32_t _nextSeq = 0;
+  uint32_t _reservedSeq = 0;
+  uint32_t _lastFrameSeq = 0;
+  uint8_t *_ioBuffer = nullptr;
+  OnSnapshotCallback _onPublish;
+
+  // false if the writer's buffers could not be allocated, then every request is refused
+  bool begin(FrameBroker *);
+  void onPublish(OnSnapshotCallback);
+  // `publish` also hands the frame to the publish callback once it is saved
+  bool request(bool publish = false);
+  void writerLoop();
+  bool write(CamFrame *, String &path);
+  uint32_t takeSeq();
+  void enforceRetention();
+  bool deleteOldest();
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TOPICS_H
+#define TOPICS_H
+
+#include <Arduino.h>
+#include "Fnv1a.h"
+
+// every topic of a device is <prefix>/<suffix>; by default the prefix is the
+// env's MQTT_TOPIC_PREFIX followed by the device's MQTT client id, see MqttHandler
+#ifndef MQTT_TOPIC_PREFIX
+#define MQTT_TOPIC_PREFIX "home/esp"
+#endif
+
+#define TOPIC_PREFIX_MAX_LEN 40
+#define TOPIC_SUFFIX_MAX_LEN 16
+#define TOPIC_BUFFER_LEN 1024
+
+// in the order of topicTable
+enum TopicId : uint8_t
+{
+  TopicTemperature,
+  TopicAirQuality,
+  TopicState,
+  TopicStateDelta, // each field of the state retained on <topic>/<field>
+  TopicRules, // local automations, see RuleEngine
+  TopicChangeState,
+  TopicChangeVolume,
+  TopicChangeGenre,
+  TopicWater,
+  TopicFan,
+  TopicSchedule,
+  TopicRestart,
+  TopicPicture,
+  TopicPictureData, // chunks go to <topic>/chunk/<index>, followed by a JSON manifest on <topic>/manifest
+  TopicMotion,
+  TopicProfile,
+  TopicDevice, // the aggregated device state, see DeviceState
+  TopicCount,
+  TopicNone = 0xFF
+};
+
+struct TopicInfo
+{
+  char suffix[TOPIC_SUFFIX_MAX_LEN];
+  uint8_t length;
+  uint8_t qos;
+  uint32_t hash;
+};
+
+#define TOPIC(suffix, qos) {suffix, sizeof(suffix) - 1, qos, fnv1a(suffix)}
+
+extern const TopicInfo topicTable[TopicCount];
+
+// the full topics, written once at boot into a single buffer; incoming
+// topics are matched by their prefix and the hash of the rest
+struct Topics
+{
+  char _buffer[TOPIC_BUFFER_LEN];
+  const char *_topics[TopicCount] = {};
+  uint8_t _prefixLen = 0;
+
+  // false if the prefix is too long, and then no topic may be used
+  bool begin(const char *prefix);
+  const char *get(TopicId id) const { return _topics[id]; }
+  uint8_t qos(TopicId id) const;
+  // TopicNone if the topic is not one of the table
+  TopicId find(const char *topic) const;
+};
+
+extern Topics topics;
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef TRACKMETADATA_H
+#define TRACKMETADATA_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define TRACK_TITLE_MAX_LEN 64
+#define TRACK_ARTIST_MAX_LEN 28
+#define TRACK_ALBUM_MAX_LEN 28
+#define TRACK_NO_REPLAY_GAIN INT16_MIN
+#define TRACK_NO_DURATION 0
+
+// the tags of a track as stored in the library index; fixed size, so a record
+// is found by its position in the file. Text is UTF-8, cut to fit.
+struct TrackMetadata
+{
+  uint32_t pathHash;
+  uint16_t durationSec;
+  int16_t replayGainCentiDb; // ReplayGain track gain, TRACK_NO_REPLAY_GAIN when untagged
+  char title[TRACK_TITLE_MAX_LEN];
+  char artist[TRACK_ARTIST_MAX_LEN];
+  char album[TRACK_ALBUM_MAX_LEN];
+};
+
+static_assert(sizeof(TrackMetadata) == 128, "metadata records are stored as they are");
+
+// reads title, artist, album, duration and ReplayGain from the ID3v2 tag of an
+// mp3, or the Vorbis comments of a FLAC, Ogg Vorbis or Opus file; fields the
+// file does not have are left empty. False for anything else.
+bool readTrackMetadata(fs::File &, TrackMetadata &);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef WATERINGSCHEDULE_H
+#define WATERINGSCHEDULE_H
+
+#include <Arduino.h>
+#include "IrrigationController.h"
+
+#define SCHEDULE_MAX_ENTRIES 16
+#define SCHEDULE_NO_TEMPERATURE_LIMIT INT8_MIN
+#define SCHEDULE_NO_HUMIDITY_LIMIT 0xFF
+#define SCHEDULE_AUTO_DURATION 0xFFFF // the irrigation controller decides how long to run
+
+// how often the radio comes up to report and pick up schedule changes
+#ifndef SPRINKLER_SYNC_INTERVAL_MIN
+#define SPRINKLER_SYNC_INTERVAL_MIN 30
+#endif
+
+// one watering (or fan) run; 8 bytes so the whole schedule fits in RTC memory
+struct ScheduleEntry
+{
+  uint8_t zone;          // actuator channel
+  uint8_t days;          // bit 0 is Sunday, bit 6 Saturday
+  uint16_t startMinute;  // minutes after local midnight
+  uint16_t durationSec;
+  int8_t skipBelowC;         // skipped when colder, SCHEDULE_NO_TEMPERATURE_LIMIT for never
+  uint8_t skipAboveHumidity; // skipped when more humid (it rained), SCHEDULE_NO_HUMIDITY_LIMIT for never
+};
+
+struct Schedule
+{
+  int16_t tzOffsetMin = 0;
+  uint16_t syncIntervalMin = SPRINKLER_SYNC_INTERVAL_MIN;
+  uint8_t count = 0;
+  uint8_t reserved[3] = {};
+  ScheduleEntry entries[SCHEDULE_MAX_ENTRIES] = {};
+};
+
+// everything that has to survive deep sleep; the clock keeps running from the
+// planned sleep time between the syncs that correct it
+struct ScheduleRtcState
+{
+  uint32_t magic;
+  uint32_t crc; // over everything below
+  uint32_t clockEpoch; // at the moment of going to sleep, 0 while unknown
+  uint32_t sleepMs;
+  uint32_t lastSyncEpoch;
+  uint32_t wakeWithRadio; // whether this wake was started with the RF calibrated
+  uint16_t lastRunDay[SCHEDULE_MAX_ENTRIES]; // local day number each entry last ran on
+  IrrigationState irrigation;
+  Schedule schedule;
+};
+
+// weather the skip conditions are checked against
+struct ScheduleConditions
+{
+  float temperatureC;
+  float humidity;
+};
+
+typedef std::function<void(const ScheduleEntry &)> OnScheduleEntryDue;
+
+// the schedule lives in LittleFS and is mirrored in RTC memory, so most wakes
+// decide what to do without the flash file system or the radio
+struct WateringSchedule
+{
+  ScheduleRtcState _state;
+  uint32_t _bootEpoch = 0; // time at millis() 0, 0 while unknown
+
+  void load();
+  // applies a schedule received as JSON, writing it only if it differs
+  bool update(const char *json, size_t length);
+
+  uint32_t now();
+  bool clockValid();
+  void setClock(uint32_t epoch);
+  void markSynced();
+  bool syncDue();
+  bool radioAvailable();
+
+  // runs what is due at this wake, checking the skip conditions first
+  void runDue(const ScheduleConditions &, OnScheduleEntryDue);
+  // seconds until the next wake, and whether that wake needs the radio
+  uint32_t secondsUntilNextWake(bool &needsRadio);
+  void prepareSleep(uint32_t sleepMs, bool withRadio);
+
+  void saveRtc();
+  bool loadRtc();
+  bool saveFile();
+  bool loadFile();
+};
+
+#endif
@@ -6,11 +6,12 @@
 
 namespace audp
 {
+  // serves single pictures on /jpg and a multipart MJPEG stream on /stream;
+  // every viewer of the stream is fed from the frames of the one capture task
   struct WebStreamer
   {
     void setCamHandler(ESPCamHandler *camHandler);
     void begin(AsyncWebServer &);
-    void loop();
   };
 }
 
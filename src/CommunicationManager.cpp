@@ -1,16 +1,17 @@
 #include "CommunicationManager.h"
 
-MessageTriggeredActionFn onOffAction(MessageTriggeredActionFn onAction, MessageTriggeredActionFn offAction)
+// plain functions, so the pair fits in a single delegate
+MessageTriggeredActionFn onOffAction(void (*onAction)(const char *, size_t), void (*offAction)(const char *, size_t))
 {
-  return [onAction, offAction](string payload)
+  return [onAction, offAction](const char *payload, size_t length)
   {
-    if (strcmp(payload.c_str(), "on") == 0)
+    if (strcmp(payload, "on") == 0)
     {
-      onAction(payload);
+      onAction(payload, length);
     }
-    else if (strcmp(payload.c_str(), "off") == 0)
+    else if (strcmp(payload, "off") == 0)
     {
-      offAction(payload);
+      offAction(payload, length);
     }
   };
 }
\ No newline at end of file
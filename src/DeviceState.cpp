@@ -0,0 +1,83 @@
+#include "DeviceState.h"
+#include <ArduinoJson.h>
+#ifdef ESP32
+#include <WiFi.h>
+#else
+#include <ESP8266WiFi.h>
+#endif
+
+DeviceState deviceState;
+
+void DeviceState::setSection(const char *name, const char *json)
+{
+  DeviceStateSection *free = nullptr;
+  for (auto &section : _sections)
+  {
+    if (section.name != nullptr && strcmp(section.name, name) == 0)
+    {
+      free = &section;
+      break;
+    }
+    if (section.name == nullptr && free == nullptr)
+    {
+      free = &section;
+    }
+  }
+
+  if (free == nullptr || strlen(json) >= DEVICE_STATE_SECTION_MAX_LEN)
+  {
+    Serial.printf("No room for %s in the device state.\n", name);
+    return;
+  }
+  free->name = name;
+  strcpy(free->json, json);
+}
+
+void DeviceState::setState(const char *name, const char *state)
+{
+  for (auto &item : _items)
+  {
+    if (item.name == nullptr || strcmp(item.name, name) == 0)
+    {
+      item.name = name;
+      item.state = state;
+      return;
+    }
+  }
+  Serial.printf("No room for %s in the device state.\n", name);
+}
+
+uint16_t DeviceState::publish(MqttHandler *mqttHandler)
+{
+#ifdef MQTT_AGGREGATE_STATE
+  StaticJsonDocument<DEVICE_STATE_MAX_LEN> doc;
+  for (auto &section : _sections)
+  {
+    if (section.name != nullptr)
+    {
+      doc[section.name] = serialized((const char *)section.json);
+    }
+  }
+
+  JsonObject states = doc.createNestedObject("states");
+  for (auto &item : _items)
+  {
+    if (item.name != nullptr)
+    {
+      states[item.name] = item.state;
+    }
+  }
+  doc["uptime"] = millis() / 1000;
+  doc["rssi"] = WiFi.RSSI();
+
+  char payload[DEVICE_STATE_MAX_LEN];
+  size_t length = serializeJson(doc, payload);
+  for (auto &section : _sections)
+  {
+    section.name = nullptr;
+  }
+  return mqttHandler->publishPayload(TopicDevice, (const uint8_t *)payload, length);
+#else
+  return 0;
+#endif
+}
\ No newline at end of file
@@ -3,17 +3,203 @@
 #include <vector>
 
 AsyncMqttClient mqttClient;
+OnConnectCallback onConnectCallbacks[MQTT_MAX_LISTENERS];
+OnMessageCallback onMessageCallbacks[MQTT_MAX_LISTENERS];
+uint8_t onConnectCallbackCount = 0;
+uint8_t onMessageCallbackCount = 0;
+OnSubscriptionsReadyCallback onSubscriptionsReadyCallback;
+
+Subscription subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+uint8_t subscriptionCount = 0;
+bool subscriptionsAreReady = false;
+
+// the hash of the subscription set the broker acknowledged, kept over deep sleep
+#ifdef ESP32
+RTC_DATA_ATTR uint32_t acknowledgedSubscriptionSet = 0;
+
+uint32_t loadAcknowledgedSubscriptionSet()
+{
+  return acknowledgedSubscriptionSet;
+}
+
+void saveAcknowledgedSubscriptionSet(uint32_t hash)
+{
+  acknowledgedSubscriptionSet = hash;
+}
+#else
+// the last two blocks of RTC user memory, after the sprinkler's schedule state
+#define MQTT_RTC_BLOCK 126
+#define MQTT_RTC_MAGIC 0x53554231 // "SUB1"
+
+uint32_t loadAcknowledgedSubscriptionSet()
+{
+  uint32_t data[2];
+  if (!ESP.rtcUserMemoryRead(MQTT_RTC_BLOCK, data, sizeof(data)) || data[0] != MQTT_RTC_MAGIC)
+  {
+    return 0;
+  }
+  return data[1];
+}
+
+void saveAcknowledgedSubscriptionSet(uint32_t hash)
+{
+  uint32_t data[2] = {MQTT_RTC_MAGIC, hash};
+  ESP.rtcUserMemoryWrite(MQTT_RTC_BLOCK, data, sizeof(data));
+}
+#endif
+
+// publishes waiting for their acknowledgement; a free slot has packet id 0
+struct PendingPublish
+{
+  uint16_t packetId = 0;
+  OnPublishedCallback onPublished;
+};
+
+PendingPublish pendingPublishes[MQTT_MAX_PENDING_PUBLISHES];
+
+#ifdef ESP32
+// recursive, since a message callback on the client's task may publish
+SemaphoreHandle_t pendingPublishesLock = xSemaphoreCreateRecursiveMutex();
+
+void lockPendingPublishes()
+{
+  xSemaphoreTakeRecursive(pendingPublishesLock, portMAX_DELAY);
+}
+
+void unlockPendingPublishes()
+{
+  xSemaphoreGiveRecursive(pendingPublishesLock);
+}
+#else
+// the ESP8266 runs the client's callbacks between loop iterations, never alongside them
+void lockPendingPublishes() {}
+void unlockPendingPublishes() {}
+#endif
+
+PendingPublish *findPendingPublish(uint16_t packetId)
+{
+  for (auto &pending : pendingPublishes)
+  {
+    if (pending.packetId == packetId)
+    {
+      return &pending;
+    }
+  }
+  return nullptr;
+}
 
 void onDisconnect(AsyncMqttClientDisconnectReason);
 void onPublish(uint16_t);
+void onSubscribe(uint16_t, uint8_t);
+
+uint32_t subscriptionSetHash()
+{
+  uint32_t h = FNV1A_OFFSET_BASIS;
+  for (uint8_t i = 0; i < subscriptionCount; i++)
+  {
+    h = fnv1a(subscriptions[i].topic, h);
+    h = fnv1aBytes(&subscriptions[i].qos, 1, h);
+  }
+  return h;
+}
+
+void setSubscriptionsReady()
+{
+  bool allGranted = true;
+  for (uint8_t i = 0; i < subscriptionCount; i++)
+  {
+    if (subscriptions[i].grantedQos == MQTT_SUBACK_FAILURE)
+    {
+      Serial.printf("Subscription to %s was refused.\n", subscriptions[i].topic);
+      allGranted = false;
+    }
+  }
+
+  // a refused subscription is tried again on the next connect
+  saveAcknowledgedSubscriptionSet(allGranted ? subscriptionSetHash() : 0);
+  subscriptionsAreReady = true;
+  if (onSubscriptionsReadyCallback != nullptr)
+  {
+    onSubscriptionsReadyCallback(allGranted);
+  }
+}
+
+void subscribeAll(bool sessionPresent)
+{
+  subscriptionsAreReady = false;
+  bool kept = sessionPresent && loadAcknowledgedSubscriptionSet() == subscriptionSetHash();
+  if (kept)
+  {
+    Serial.println("Subscriptions kept by the broker's session.");
+  }
+
+  // the client sends one filter per SUBSCRIBE, so they all go out back to
+  // back and are acknowledged in any order
+  bool pending = false;
+  for (uint8_t i = 0; i < subscriptionCount; i++)
+  {
+    Subscription &subscription = subscriptions[i];
+    if (kept && !subscription.renew)
+    {
+      subscription.packetId = 0;
+      subscription.grantedQos = subscription.qos;
+      continue;
+    }
+
+    subscription.packetId = mqttClient.subscribe(subscription.topic, subscription.qos);
+    subscription.grantedQos = subscription.packetId != 0 ? MQTT_SUBACK_PENDING : MQTT_SUBACK_FAILURE;
+    Serial.printf("Subscribing to topic %s with qos %d\n", subscription.topic, subscription.qos);
+    pending |= subscription.packetId != 0;
+  }
+  if (!pending)
+  {
+    setSubscriptionsReady();
+  }
+}
+
+// registered with the client once, as plain functions its own std::function
+// holds without allocating
+void dispatchConnect(bool sessionPresent)
+{
+  subscribeAll(sessionPresent);
+  for (uint8_t i = 0; i < onConnectCallbackCount; i++)
+  {
+    onConnectCallbacks[i](sessionPresent);
+  }
+}
+
+void dispatchMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)
+{
+  for (uint8_t i = 0; i < onMessageCallbackCount; i++)
+  {
+    onMessageCallbacks[i](topic, payload, properties, len, index, total);
+  }
+}
 
-void MqttHandler::init(MqttConfig &config)
+bool MqttHandler::init(MqttConfig &config, const char *topicPrefix)
 {
+  char devicePrefix[64];
+  if (topicPrefix == nullptr)
+  {
+    snprintf(devicePrefix, sizeof(devicePrefix), "%s/%s", MQTT_TOPIC_PREFIX, mqttClient.getClientId());
+    topicPrefix = devicePrefix;
+  }
+  if (!topics.begin(topicPrefix))
+  {
+    Serial.println("Unable to set up the MQTT topics, MQTT is not started.");
+    return false;
+  }
+  Serial.printf("MQTT topics are under %s.\n", topicPrefix);
+
   mqttClient.setCleanSession(config.cleanSession);
   mqttClient.setServer(config.host.c_str(), config.port);
   mqttClient.setCredentials(config.username.c_str(), config.password.c_str());
+  mqttClient.onConnect(dispatchConnect);
+  mqttClient.onMessage(dispatchMessage);
   mqttClient.onDisconnect(onDisconnect);
   mqttClient.onPublish(onPublish);
+  mqttClient.onSubscribe(onSubscribe);
+  return true;
 }
 
 void MqttHandler::connect()
@@ -39,29 +225,133 @@ void MqttHandler::subscribe(const char *topic, uint8_t qos)
   Serial.printf("Subscribed to topic %s with qos %d\n", topic, qos);
 }
 
-void MqttHandler::onConnect(OnConnectCallback onConnectCallback)
+bool MqttHandler::addSubscription(const char *topic, uint8_t qos, bool renew)
 {
-  mqttClient.onConnect(onConnectCallback);
+  if (subscriptionCount == MQTT_MAX_SUBSCRIPTIONS)
+  {
+    Serial.printf("Too many subscriptions, %s left out.\n", topic);
+    return false;
+  }
+
+  Subscription &subscription = subscriptions[subscriptionCount++];
+  subscription.topic = topic;
+  subscription.qos = qos;
+  subscription.renew = renew;
+  return true;
+}
+
+bool MqttHandler::addSubscription(TopicId id, bool renew)
+{
+  return addSubscription(topics.get(id), topics.qos(id), renew);
 }
 
-void MqttHandler::onMessage(OnMessageCallback onMessageCallback)
+bool MqttHandler::subscriptionsReady()
 {
-  mqttClient.onMessage(onMessageCallback);
+  return subscriptionsAreReady;
 }
 
-void MqttHandler::publishPayload(String topic, String payload, bool retain)
+void MqttHandler::onSubscriptionsReady(const OnSubscriptionsReadyCallback &callback)
 {
-  const char *topicCStr = topic.c_str();
-  const char *payloadCStr = payload.c_str();
+  onSubscriptionsReadyCallback = callback;
+}
 
+bool MqttHandler::onConnect(const OnConnectCallback &callback)
+{
+  if (onConnectCallbackCount == MQTT_MAX_LISTENERS)
+  {
+    Serial.printf("MQTT is limited to %d connect listeners, one left out.\n", MQTT_MAX_LISTENERS);
+    return false;
+  }
+  onConnectCallbacks[onConnectCallbackCount++] = callback;
+  return true;
+}
+
+bool MqttHandler::onMessage(const OnMessageCallback &callback)
+{
+  if (onMessageCallbackCount == MQTT_MAX_LISTENERS)
+  {
+    Serial.printf("MQTT is limited to %d message listeners, one left out.\n", MQTT_MAX_LISTENERS);
+    return false;
+  }
+  onMessageCallbacks[onMessageCallbackCount++] = callback;
+  return true;
+}
+
+uint16_t MqttHandler::publishPayload(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, bool retain, const OnPublishedCallback &onPublished)
+{
   if (!mqttClient.connected())
   {
-    Serial.printf("MQTT client is disconnected, unable to send payload to topic %s\n", topicCStr);
-    return;
+    Serial.printf("MQTT client is disconnected, unable to send payload to topic %s\n", topic);
+    return 0;
+  }
+
+  // registered under the lock, so an acknowledgement arriving right away still finds it
+  lockPendingPublishes();
+  uint16_t packetId = 0;
+  PendingPublish *pending = nullptr;
+  if (qos > 0 && onPublished != nullptr)
+  {
+    pending = findPendingPublish(0);
+    if (pending == nullptr)
+    {
+      Serial.printf("Too many publishes waiting for acknowledgement, dropping payload to topic %s\n", topic);
+      unlockPendingPublishes();
+      return 0;
+    }
+  }
+
+  packetId = mqttClient.publish(topic, qos, retain, (const char *)payload, length);
+  if (packetId != 0 && pending != nullptr)
+  {
+    pending->packetId = packetId;
+    pending->onPublished = onPublished;
+  }
+  unlockPendingPublishes();
+
+  if (packetId != 0 && qos == 0 && onPublished != nullptr)
+  {
+    onPublished(packetId, true);
+  }
+  return packetId;
+}
+
+uint16_t MqttHandler::publishPayload(const char *topic, const char *payload, uint8_t qos, bool retain, const OnPublishedCallback &onPublished)
+{
+  uint16_t packetId = publishPayload(topic, (const uint8_t *)payload, strlen(payload), qos, retain, onPublished);
+  if (packetId != 0)
+  {
+    Serial.printf("Payload published to topic %s: %s\n", topic, payload);
   }
+  return packetId;
+}
+
+uint16_t MqttHandler::publishPayload(TopicId id, const uint8_t *payload, size_t length, bool retain, const OnPublishedCallback &onPublished)
+{
+  return publishPayload(topics.get(id), payload, length, topics.qos(id), retain, onPublished);
+}
 
-  mqttClient.publish(topicCStr, 0, retain, payloadCStr);
-  Serial.printf("Payload published to topic %s: %s\n", topicCStr, payloadCStr);
+uint16_t MqttHandler::publishPayload(TopicId id, const char *payload, bool retain, const OnPublishedCallback &onPublished)
+{
+  return publishPayload(topics.get(id), payload, topics.qos(id), retain, onPublished);
+}
+
+void onSubscribe(uint16_t packetId, uint8_t qos)
+{
+  bool pending = false;
+  for (uint8_t i = 0; i < subscriptionCount; i++)
+  {
+    Subscription &subscription = subscriptions[i];
+    if (subscription.packetId == packetId && subscription.grantedQos == MQTT_SUBACK_PENDING)
+    {
+      subscription.grantedQos = qos;
+    }
+    pending |= subscription.grantedQos == MQTT_SUBACK_PENDING;
+  }
+
+  if (!pending && !subscriptionsAreReady)
+  {
+    setSubscriptionsReady();
+  }
 }
 
 void onDisconnect(AsyncMqttClientDisconnectReason reason)
@@ -69,10 +359,42 @@ void onDisconnect(AsyncMqttClientDisconnectReason reason)
   Serial.print("MQTT client is disconnected with reason: ");
   int r = (int8_t)reason;
   Serial.println(r);
+  subscriptionsAreReady = false;
+
+  // the client forgets its in-flight messages with the connection
+  lockPendingPublishes();
+  for (auto &pending : pendingPublishes)
+  {
+    if (pending.packetId != 0)
+    {
+      uint16_t packetId = pending.packetId;
+      OnPublishedCallback onPublished = pending.onPublished;
+      pending.packetId = 0;
+      pending.onPublished = nullptr;
+      onPublished(packetId, false);
+    }
+  }
+  unlockPendingPublishes();
 }
 
 void onPublish(uint16_t packetId)
 {
   Serial.print("Payload published with packet id: ");
   Serial.println(packetId);
+
+  lockPendingPublishes();
+  PendingPublish *pending = findPendingPublish(packetId);
+  OnPublishedCallback onPublished;
+  if (pending != nullptr)
+  {
+    onPublished = pending->onPublished;
+    pending->packetId = 0;
+    pending->onPublished = nullptr;
+  }
+  unlockPendingPublishes();
+
+  if (onPublished != nullptr)
+  {
+    onPublished(packetId, true);
+  }
 }
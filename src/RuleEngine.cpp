@@ -0,0 +1,300 @@
+#include "RuleEngine.h"
+#include <ArduinoJson.h>
+
+#define RULE_DEFINITION_MAX_LEN 1024
+
+#ifdef ESP32
+#define RULES_LOCK() portENTER_CRITICAL(&_mux)
+#define RULES_UNLOCK() portEXIT_CRITICAL(&_mux)
+#else
+// the ESP8266 runs the network callbacks on the loop's own context
+#define RULES_LOCK()
+#define RULES_UNLOCK()
+#endif
+
+void RuleEngine::addAction(const char *topic, const MessageTriggeredActionFn &fn)
+{
+  if (_actionCount == RULE_MAX_ACTIONS)
+  {
+    Serial.printf("Rule engine is limited to %d actions, %s left out.\n", RULE_MAX_ACTIONS, topic);
+    return;
+  }
+  _actions[_actionCount++] = {fnv1a(topic), fn};
+}
+
+const char *skipSpaces(const char *p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+  {
+    p++;
+  }
+  return p;
+}
+
+bool parseOp(const char *&p, RuleOp &op)
+{
+  if (p[0] == '\0')
+  {
+    return false;
+  }
+  if (p[0] == '>' && p[1] != '=')
+  {
+    op = RuleGreater;
+  }
+  else if (p[0] == '<' && p[1] != '=')
+  {
+    op = RuleLess;
+  }
+  else if (p[1] != '=')
+  {
+    return false;
+  }
+  else if (p[0] == '>')
+  {
+    op = RuleGreaterOrEqual;
+  }
+  else if (p[0] == '<')
+  {
+    op = RuleLessOrEqual;
+  }
+  else if (p[0] == '=')
+  {
+    op = RuleEqual;
+  }
+  else if (p[0] == '!')
+  {
+    op = RuleNotEqual;
+  }
+  else
+  {
+    return false;
+  }
+  p += (op == RuleGreater || op == RuleLess) ? 1 : 2;
+  return true;
+}
+
+// the whole definition replaces the previous rules, or nothing changes if any rule is invalid
+bool RuleEngine::compile(const char *definition, const OnRuleTopic &onTopic)
+{
+  Rule rules[RULE_MAX_RULES];
+  const char *signals[RULE_MAX_RULES];
+  size_t signalLens[RULE_MAX_RULES];
+  uint8_t count = 0;
+
+  if (strnlen(definition, RULE_DEFINITION_MAX_LEN + 1) > RULE_DEFINITION_MAX_LEN)
+  {
+    Serial.printf("Rule definition is longer than %d characters, ignored.\n", RULE_DEFINITION_MAX_LEN);
+    return false;
+  }
+
+  const char *p = definition;
+  while (*(p = skipSpaces(p)) != '\0')
+  {
+    if (count == RULE_MAX_RULES)
+    {
+      Serial.printf("Only the first %d rules are kept.\n", RULE_MAX_RULES);
+      break;
+    }
+
+    Rule &rule = rules[count];
+    const char *signal = p;
+    while (*p != '\0' && *p != ' ' && *p != '<' && *p != '>' && *p != '=' && *p != '!')
+    {
+      p++;
+    }
+    size_t signalLen = p - signal;
+    p = skipSpaces(p);
+
+    char *end;
+    if (signalLen == 0 || !parseOp(p, rule.op))
+    {
+      Serial.printf("Invalid rule at: %s\n", signal);
+      return false;
+    }
+    float threshold = strtof(p, &end);
+    bool hasThreshold = end != p;
+    p = skipSpaces(end);
+    if (!hasThreshold || strncmp(p, "=>", 2) != 0)
+    {
+      Serial.printf("Invalid rule at: %s\n", signal);
+      return false;
+    }
+    p = skipSpaces(p + 2);
+
+    const char *action = p;
+    while (*p != '\0' && *p != ':' && *p != ';' && *p != ' ')
+    {
+      p++;
+    }
+    uint32_t actionHash = fnv1aBytes(action, p - action);
+
+    const char *payload = "";
+    size_t payloadLen = 0;
+    if (*p == ':')
+    {
+      payload = ++p;
+      while (*p != '\0' && *p != ';' && *p != ' ')
+      {
+        p++;
+      }
+      payloadLen = p - payload;
+    }
+    p = skipSpaces(p);
+    if (*p == ';')
+    {
+      p++;
+    }
+
+    int actionIndex = -1;
+    for (int i = 0; i < _actionCount; i++)
+    {
+      if (_actions[i].topicHash == actionHash)
+      {
+        actionIndex = i;
+      }
+    }
+    if (actionIndex < 0 || payloadLen >= RULE_PAYLOAD_MAX_LEN)
+    {
+      Serial.printf("Rule on %.*s has an unknown action or a payload too long.\n", (int)signalLen, signal);
+      return false;
+    }
+
+    signals[count] = signal;
+    signalLens[count] = signalLen;
+    rule.signal = fnv1aBytes(signal, signalLen);
+    rule.threshold = (int32_t)lroundf(threshold * 100);
+    rule.action = actionIndex;
+    rule.active = false;
+    memcpy(rule.payload, payload, payloadLen);
+    rule.payload[payloadLen] = '\0';
+    count++;
+  }
+
+  RULES_LOCK();
+  memcpy(_rules, rules, sizeof(Rule) * count);
+  _ruleCount = count;
+  RULES_UNLOCK();
+  Serial.printf("%d rules compiled.\n", count);
+
+  for (uint8_t i = 0; i < count && onTopic != nullptr; i++)
+  {
+    if (memchr(signals[i], '/', signalLens[i]) != nullptr)
+    {
+      char topic[128];
+      snprintf(topic, sizeof(topic), "%.*s", (int)signalLens[i], signals[i]);
+      onTopic(topic);
+    }
+  }
+  return true;
+}
+
+void RuleEngine::evaluate(uint32_t signal, float value)
+{
+  int32_t v = (int32_t)lroundf(value * 100);
+  // the actions may take a while, so the rules that fire are copied out and
+  // their actions called once the lock is released
+  uint8_t fired[RULE_MAX_RULES];
+  uint8_t firedActions[RULE_MAX_RULES];
+  char firedPayloads[RULE_MAX_RULES][RULE_PAYLOAD_MAX_LEN];
+  uint8_t firedCount = 0;
+
+  RULES_LOCK();
+  for (uint8_t i = 0; i < _ruleCount; i++)
+  {
+    Rule &rule = _rules[i];
+    if (rule.signal != signal)
+    {
+      continue;
+    }
+
+    bool matches;
+    switch (rule.op)
+    {
+    case RuleGreater:
+      matches = v > rule.threshold;
+      break;
+    case RuleGreaterOrEqual:
+      matches = v >= rule.threshold;
+      break;
+    case RuleLess:
+      matches = v < rule.threshold;
+      break;
+    case RuleLessOrEqual:
+      matches = v <= rule.threshold;
+      break;
+    case RuleEqual:
+      matches = v == rule.threshold;
+      break;
+    default:
+      matches = v != rule.threshold;
+      break;
+    }
+
+    bool fire = matches && !rule.active;
+    rule.active = matches;
+    if (fire)
+    {
+      fired[firedCount] = i;
+      firedActions[firedCount] = rule.action;
+      memcpy(firedPayloads[firedCount], rule.payload, RULE_PAYLOAD_MAX_LEN);
+      firedCount++;
+    }
+  }
+  RULES_UNLOCK();
+
+  for (uint8_t i = 0; i < firedCount; i++)
+  {
+    Serial.printf("Rule %d triggered.\n", fired[i]);
+    _actions[firedActions[i]].fn(firedPayloads[i], strlen(firedPayloads[i]));
+  }
+}
+
+void RuleEngine::onSensorPayload(const char *payload)
+{
+  if (_ruleCount == 0)
+  {
+    return;
+  }
+
+  StaticJsonDocument<256> doc;
+  if (deserializeJson(doc, payload))
+  {
+    return;
+  }
+  for (JsonPair field : doc.as<JsonObject>())
+  {
+    if (field.value().is<float>())
+    {
+      const char *key = field.key().c_str();
+      evaluate(fnv1a(key), field.value().as<float>());
+    }
+  }
+}
+
+void RuleEngine::onMessage(const char *topic, const char *payload)
+{
+  if (_ruleCount == 0)
+  {
+    return;
+  }
+
+  float value;
+  if (strcmp(payload, "on") == 0)
+  {
+    value = 1;
+  }
+  else if (strcmp(payload, "off") == 0)
+  {
+    value = 0;
+  }
+  else
+  {
+    char *end;
+    value = strtof(payload, &end);
+    if (end == payload)
+    {
+      return;
+    }
+  }
+  evaluate(fnv1a(topic), value);
+}
@@ -1,127 +1,105 @@
 #include "SensorHandler.h"
 
-TemperatureSensor *initTemperatureSensor(TemperatureSensorConfig sensorConfig)
+// only the create functions of the sensors a firmware's SensorHandler names
+// are referenced, so the other drivers are left out of its image
+
+DHT11TemperatureSensor *DHT11TemperatureSensor::create(const TemperatureSensorConfig &sensorConfig)
 {
-  switch (sensorConfig.type)
-  {
-  case NoopTempSensor:
+  DHT *dht = new DHT(sensorConfig.DHTPin, DHT11);
+  dht->begin();
+  return new DHT11TemperatureSensor(dht);
+}
+
+BME280TemperatureSensor *BME280TemperatureSensor::create(const TemperatureSensorConfig &sensorConfig)
+{
+  TwoWire *I2CBME;
+#ifdef ESP8266
+  I2CBME = new TwoWire();
+  I2CBME->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
+#elif defined(ESP32)
+  I2CBME = new TwoWire(0);
+  bool status = I2CBME->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
+  if (!status)
   {
+    Serial.println("Could not find a valid BME280 sensor, check wiring!");
     return nullptr;
   }
-  case DHT11Sensor:
-  {
-    DHT *dht = new DHT(sensorConfig.DHTPin, DHT11);
-    dht->begin();
-    return new DHT11TemperatureSensor(dht);
-  }
-  case BME280Sensor:
-  {
-    TwoWire *I2CBME;
-#ifdef ESP8266
-    I2CBME = new TwoWire();
-    I2CBME->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
-#elif defined(ESP32)
-    I2CBME = new TwoWire(0);
-    bool status = I2CBME->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
-    if (!status)
-    {
-      Serial.println("Could not find a valid BME280 sensor, check wiring!");
-      return nullptr;
-    }
 #else
 #error "Unsupported platform"
 #endif
 
-    Adafruit_BME280 *bme = new Adafruit_BME280();
-    bme->begin(0x76, I2CBME);
-    return new BME280TemperatureSensor(bme);
-  }
-  case AHT21:
-  {
-    TwoWire *wire;
+  Adafruit_BME280 *bme = new Adafruit_BME280();
+  bme->begin(0x76, I2CBME);
+  return new BME280TemperatureSensor(bme);
+}
+
+AHT21Sensor *AHT21Sensor::create(const TemperatureSensorConfig &sensorConfig)
+{
+  TwoWire *wire;
 #ifdef ESP8266
-    wire = new TwoWire();
-    wire->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
+  wire = new TwoWire();
+  wire->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
 #elif defined(ESP32)
-    wire = new TwoWire(0);
-    bool status = wire->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
-    if (!status)
-    {
-      Serial.println("Could not start wiring between SDA & SCL, check wiring!");
-      return nullptr;
-    }
-#endif
-
-    Adafruit_AHTX0 *aht = new Adafruit_AHTX0();
-    if (!aht->begin(wire))
-    {
-      Serial.println("Could not start AHT sensor, check wiring!");
-      return nullptr;
-    }
-
-    return new AHT21Sensor(aht);
-  }
-
-  case Type_ENS210:
+  wire = new TwoWire(0);
+  bool status = wire->begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
+  if (!status)
   {
-    ENS210 *ens210 = new ENS210();
-    Wire.begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
-    bool ok = ens210->begin();
-    if (!ok)
-    {
-      Serial.println("ENS210 not initiated.");
-      return nullptr;
-    }
-    return new ENS210Sensor(ens210);
+    Serial.println("Could not start wiring between SDA & SCL, check wiring!");
+    return nullptr;
   }
+#endif
 
-  default:
-    Serial.printf("Cannot find the temp sensor type specified: %d", sensorConfig.type);
+  Adafruit_AHTX0 *aht = new Adafruit_AHTX0();
+  if (!aht->begin(wire))
+  {
+    Serial.println("Could not start AHT sensor, check wiring!");
     return nullptr;
   }
+
+  return new AHT21Sensor(aht);
 }
 
-AirQualitySensor *initAirQualitySensor(AirQualitySensorConfig config)
+ENS210Sensor *ENS210Sensor::create(const TemperatureSensorConfig &sensorConfig)
 {
-  switch (config.type)
-  {
-  case NoSensor:
+  ENS210 *ens210 = new ENS210();
+  Wire.begin(sensorConfig.SDAPin, sensorConfig.SCLPin);
+  bool ok = ens210->begin();
+  if (!ok)
   {
+    Serial.println("ENS210 not initiated.");
     return nullptr;
   }
-  case ENS160:
-  {
-    ScioSense_ENS160 *ens160 = new ScioSense_ENS160(ENS160_I2CADDR_1);
-    ens160->setI2C(config.SDAPin, config.SCLPin);
-
-    if (!ens160->begin())
-    {
-      Serial.println("Unable to start ENS160.");
-      return nullptr;
-    }
-
-    if (!ens160->available())
-    {
-      Serial.println("ENS160 sensor is not available.");
-      return nullptr;
-    }
+  return new ENS210Sensor(ens210);
+}
 
-    if (!ens160->setMode(ENS160_OPMODE_STD))
-    {
-      Serial.println("Unable to set ENS160 to standard mode.");
-      return nullptr;
-    }
+ENS160Sensor *ENS160Sensor::create(const AirQualitySensorConfig &config)
+{
+  ScioSense_ENS160 *ens160 = new ScioSense_ENS160(ENS160_I2CADDR_1);
+  ens160->setI2C(config.SDAPin, config.SCLPin);
 
-    return new ENS160Sensor(ens160, config.location);
-  }
-  case Type_MQ135:
+  if (!ens160->begin())
   {
-    MQ135 *sensor = new MQ135(A0);
-    return new MQ135Sensor(sensor, config.location);
+    Serial.println("Unable to start ENS160.");
+    return nullptr;
   }
-  default:
+
+  if (!ens160->available())
   {
+    Serial.println("ENS160 sensor is not available.");
     return nullptr;
   }
+
+  if (!ens160->setMode(ENS160_OPMODE_STD))
+  {
+    Serial.println("Unable to set ENS160 to standard mode.");
+    return nullptr;
   }
+
+  return new ENS160Sensor(ens160, config.location);
+}
+
+MQ135Sensor *MQ135Sensor::create(const AirQualitySensorConfig &config)
+{
+  MQ135 *sensor = new MQ135(A0);
+  return new MQ135Sensor(sensor, config.location);
 }
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "Topics.h"
+
+// kept in flash; the suffixes are written into RAM once, after the prefix
+const TopicInfo topicTable[TopicCount] PROGMEM = {
+    TOPIC("temperature", 0),
+    TOPIC("aqi", 0),
+    TOPIC("state", 0),
+    TOPIC("state/delta", 0),
+    TOPIC("rules", 1),
+    TOPIC("state/set", 1),
+    TOPIC("volume/set", 1),
+    TOPIC("genre/set", 1),
+    TOPIC("water", 1),
+    TOPIC("fan", 1),
+    TOPIC("schedule", 1),
+    TOPIC("restart", 0),
+    TOPIC("picture", 0),
+    TOPIC("picture/data", 0),
+    TOPIC("motion", 0),
+    TOPIC("profile", 1),
+    TOPIC("device", 0),
+};
+
+Topics topics;
+
+bool Topics::begin(const char *prefix)
+{
+  size_t prefixLen = strlen(prefix);
+  if (prefixLen > TOPIC_PREFIX_MAX_LEN)
+  {
+    Serial.printf("Topic prefix %s is too long.\n", prefix);
+    return false;
+  }
+
+  size_t pos = 0;
+  for (uint8_t id = 0; id < TopicCount; id++)
+  {
+    TopicInfo info;
+    memcpy_P(&info, &topicTable[id], sizeof(TopicInfo));
+    if (pos + prefixLen + info.length + 2 > TOPIC_BUFFER_LEN)
+    {
+      Serial.println("Topic buffer is too small for the topic table.");
+      return false;
+    }
+
+    _topics[id] = _buffer + pos;
+    memcpy(_buffer + pos, prefix, prefixLen);
+    pos += prefixLen;
+    _buffer[pos++] = '/';
+    memcpy(_buffer + pos, info.suffix, info.length + 1);
+    pos += info.length + 1;
+  }
+  _prefixLen = prefixLen;
+  return true;
+}
+
+uint8_t Topics::qos(TopicId id) const
+{
+  return pgm_read_byte(&topicTable[id].qos);
+}
+
+TopicId Topics::find(const char *topic) const
+{
+  if (_topics[0] == nullptr || strncmp(topic, _buffer, _prefixLen) != 0 || topic[_prefixLen] != '/')
+  {
+    return TopicNone;
+  }
+
+  const char *suffix = topic + _prefixLen + 1;
+  uint32_t hash = fnv1a(suffix);
+  size_t length = strlen(suffix);
+  for (uint8_t id = 0; id < TopicCount; id++)
+  {
+    if (pgm_read_dword(&topicTable[id].hash) == hash && pgm_read_byte(&topicTable[id].length) == length)
+    {
+      return (TopicId)id;
+    }
+  }
+  return TopicNone;
+}
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "CamProfile.h"
+
+#define CAM_QUALITY_WINDOW_MS 2000
+#define CAM_QUALITY_RECOVER_MS 15000 // a step back up needs this long without pressure
+#define CAM_QUALITY_IDLE_MS 10000    // the stream is considered gone after this long without deliveries
+#define CAM_QUALITY_MAX 63
+
+const CamProfile camProfiles[] = {
+    {"snapshot", FRAMESIZE_SXGA, 16, 1, 1, 1, GAINCEILING_2X, false},
+    {"stream", FRAMESIZE_SVGA, 12, 1, 1, 1, GAINCEILING_2X, false},
+    {"night", FRAMESIZE_SVGA, 12, 2, 1, 0, GAINCEILING_16X, true},
+};
+
+// each step down first compresses harder, then drops to the next smaller frame size
+struct CamLevel
+{
+  uint8_t qualityOffset;
+  uint8_t frameSizeSteps;
+};
+
+const CamLevel camLevels[] = {{0, 0}, {6, 0}, {6, 1}, {12, 1}, {12, 2}, {20, 2}};
+const uint8_t camLevelCount = sizeof(camLevels) / sizeof(camLevels[0]);
+
+const framesize_t frameSizeLadder[] = {FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_SXGA, FRAMESIZE_UXGA};
+const int frameSizeLadderCount = sizeof(frameSizeLadder) / sizeof(frameSizeLadder[0]);
+
+void runCamQualityController(void *);
+
+const CamProfile *CamQualityController::findProfile(const char *name)
+{
+  for (const CamProfile &profile : camProfiles)
+  {
+    if (strcmp(profile.name, name) == 0)
+    {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+void CamQualityController::begin(FrameBroker *frameBroker)
+{
+  _frameBroker = frameBroker;
+  const CamProfile *profile = findProfile(CAM_DEFAULT_PROFILE);
+  applyProfile(profile != nullptr ? profile : &camProfiles[0]);
+
+  xTaskCreatePinnedToCore(
+      runCamQualityController,
+      "Cam quality",
+      3072,
+      this,
+      1,
+      NULL,
+      0);
+}
+
+void runCamQualityController(void *parameter)
+{
+  CamQualityController *controller = (CamQualityController *)parameter;
+  for (;;)
+  {
+    controller->loop();
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+}
+
+bool CamQualityController::requestProfile(const char *name)
+{
+  if (findProfile(name) == nullptr)
+  {
+    Serial.printf("Unknown camera profile %s.\n", name);
+    return false;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  strlcpy(_pendingProfile, name, CAM_PROFILE_NAME_MAX_LEN);
+  portEXIT_CRITICAL(&_mux);
+  return true;
+}
+
+void CamQualityController::reportDelivery(uint32_t ms)
+{
+  portENTER_CRITICAL(&_mux);
+  _deliveries++;
+  _deliveryMsSum += ms;
+  if (ms > 1000 / CAM_STREAM_TARGET_FPS)
+  {
+    _slowDeliveries++;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+void CamQualityController::loop()
+{
+  char pending[CAM_PROFILE_NAME_MAX_LEN];
+  portENTER_CRITICAL(&_mux);
+  strlcpy(pending, _pendingProfile, CAM_PROFILE_NAME_MAX_LEN);
+  _pendingProfile[0] = '\0';
+  portEXIT_CRITICAL(&_mux);
+
+  if (pending[0] != '\0')
+  {
+    applyProfile(findProfile(pending));
+  }
+
+  unsigned long now = millis();
+  if (now - _windowStartMs >= CAM_QUALITY_WINDOW_MS)
+  {
+    evaluate(now);
+  }
+}
+
+void CamQualityController::evaluate(unsigned long now)
+{
+  portENTER_CRITICAL(&_mux);
+  uint32_t deliveries = _deliveries;
+  uint32_t slowDeliveries = _slowDeliveries;
+  uint32_t deliveryMsSum = _deliveryMsSum;
+  _deliveries = 0;
+  _slowDeliveries = 0;
+  _deliveryMsSum = 0;
+  portEXIT_CRITICAL(&_mux);
+  _windowStartMs = now;
+
+  if (deliveries == 0)
+  {
+    // nobody is watching, so snapshots get the profile as it is again
+    if (_level > 0 && now - _lastDeliveryMs >= CAM_QUALITY_IDLE_MS)
+    {
+      applyLevel(0);
+    }
+    return;
+  }
+  _lastDeliveryMs = now;
+
+  const uint32_t targetMs = 1000 / CAM_STREAM_TARGET_FPS;
+  uint32_t averageMs = deliveryMsSum / deliveries;
+  bool clientsBehind = slowDeliveries * 2 > deliveries;
+  bool captureBehind = _frameBroker->_frameMs > targetMs + targetMs / 4;
+
+  if (clientsBehind || captureBehind)
+  {
+    _lastPressureMs = now;
+    if (_level + 1 < camLevelCount)
+    {
+      Serial.printf("Stream falling behind (%u ms per delivery, %u ms per capture), stepping down.\n", averageMs, _frameBroker->_frameMs);
+      applyLevel(_level + 1);
+    }
+    return;
+  }
+
+  // only step back up with clear headroom, so the level does not flap
+  if (_level > 0 && averageMs < targetMs / 2 && now - _lastPressureMs >= CAM_QUALITY_RECOVER_MS)
+  {
+    _lastPressureMs = now;
+    applyLevel(_level - 1);
+  }
+}
+
+void CamQualityController::applyProfile(const CamProfile *profile)
+{
+  sensor_t *s = esp_camera_sensor_get();
+  s->set_brightness(s, profile->brightness);
+  s->set_contrast(s, profile->contrast);
+  s->set_saturation(s, profile->saturation);
+  s->set_gainceiling(s, profile->gainCeiling);
+  s->set_aec2(s, profile->nightMode ? 1 : 0);
+  s->set_ae_level(s, profile->nightMode ? 2 : 0);
+
+  _profile = profile;
+  _lastPressureMs = millis();
+  applyLevel(0);
+  Serial.printf("Camera profile %s applied.\n", profile->name);
+}
+
+void CamQualityController::applyLevel(uint8_t level)
+{
+  const CamLevel &camLevel = camLevels[level];
+
+  int index = 0;
+  while (index < frameSizeLadderCount - 1 && frameSizeLadder[index] < _profile->frameSize)
+  {
+    index++;
+  }
+  index = max(0, index - camLevel.frameSizeSteps);
+  framesize_t frameSize = frameSizeLadder[index];
+  uint8_t quality = min(_profile->quality + camLevel.qualityOffset, CAM_QUALITY_MAX);
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (s->status.framesize != frameSize)
+  {
+    s->set_framesize(s, frameSize);
+  }
+  s->set_quality(s, quality);
+
+  _level = level;
+  Serial.printf("Camera at level %d: %dx%d, quality %d.\n", level, resolution[frameSize].width, resolution[frameSize].height, quality);
+}
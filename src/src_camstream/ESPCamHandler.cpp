@@ -9,6 +9,9 @@
 #include "Config.h"
 
 OV2640 _cam;
+FrameBroker frameBroker;
+SnapshotWriter snapshotWriter;
+CamQualityController qualityController;
 
 void ESPCamHandler::init()
 {
@@ -34,45 +37,46 @@ void ESPCamHandler::init()
   config.xclk_freq_hz = 20000000;
   config.pixel_format = PIXFORMAT_JPEG;
 
+  // the largest frame size of any profile, the driver's buffers are sized for it
   config.frame_size = FRAMESIZE_SXGA; // FRAMESIZE_ + QVGA|CIF|VGA|SVGA|XGA|SXGA|UXGA
   config.jpeg_quality = 16;
   config.fb_count = 2;
   config.fb_location = CAMERA_FB_IN_PSRAM;
+  config.grab_mode = CAMERA_GRAB_LATEST; // sampled captures after an idle period must not be stale
 
   _cam.init(config);
-
-  // Cam settings
-  sensor_t1 *s = esp_camera_sensor_get();
-  s->set_brightness(s, 1);
-  s->set_contrast(s, 1);
-  s->set_saturation(s, 1);
 }
 
+// only queues the picture, the snapshot writer saves and publishes it from its own task
 void ESPCamHandler::takePicAndSave()
 {
-  _cam.run();
+  snapshotWriter.request(true);
+}
+
+OV2640 *ESPCamHandler::getCam()
+{
+  return &_cam;
+}
 
-  int pictureNumber = random(0, INT_MAX);
-  // Path where new picture will be saved in SD Card
-  String path = "/img_" + String(pictureNumber) + ".jpg";
+void ESPCamHandler::startCapture()
+{
+  // the sensor settings come from the active profile
+  qualityController.begin(&frameBroker);
+  frameBroker.begin();
+  snapshotWriter.begin(&frameBroker);
+}
 
-  fs::FS &fs = SD_MMC;
-  Serial.printf("Picture file name: %s\n", path.c_str());
+FrameBroker *ESPCamHandler::getFrameBroker()
+{
+  return &frameBroker;
+}
 
-  File file = fs.open(path.c_str(), FILE_WRITE);
-  if (!file)
-  {
-    Serial.println("Failed to open file in writing mode");
-  }
-  else
-  {
-    file.write(_cam.getfb(), _cam.getSize()); // payload (image), payload length
-    Serial.printf("Saved file at path: %s\n", path.c_str());
-  }
-  file.close();
+SnapshotWriter *ESPCamHandler::getSnapshotWriter()
+{
+  return &snapshotWriter;
 }
 
-OV2640 *ESPCamHandler::getCam()
+CamQualityController *ESPCamHandler::getQualityController()
 {
-  return &_cam;
+  return &qualityController;
 }
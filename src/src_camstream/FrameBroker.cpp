@@ -0,0 +1,159 @@
+#include "FrameBroker.h"
+#include "esp_heap_caps.h"
+
+void runFrameCapture(void *);
+
+void FrameBroker::begin()
+{
+  xTaskCreatePinnedToCore(
+      runFrameCapture,
+      "Capture",
+      4096,
+      this,
+      5,
+      &_captureTask,
+      1);
+}
+
+void runFrameCapture(void *parameter)
+{
+  ((FrameBroker *)parameter)->captureLoop();
+}
+
+void FrameBroker::captureLoop()
+{
+  for (;;)
+  {
+    if (_consumers == 0)
+    {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb == nullptr)
+    {
+      Serial.println("Camera capture failed.");
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    // any slot but the latest one that nobody references takes the frame
+    int slot = -1;
+    portENTER_CRITICAL(&_mux);
+    for (int i = 0; i < CAM_FRAME_POOL_SIZE; i++)
+    {
+      if (i != _latest && _frames[i].refs == 0)
+      {
+        slot = i;
+        _frames[i].refs = 1; // keeps the slot while it is filled
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    if (slot < 0)
+    {
+      // every buffer is still being read, drop this capture rather than stall the driver
+      _dropped++;
+      esp_camera_fb_return(fb);
+      continue;
+    }
+
+    CamFrame &frame = _frames[slot];
+    if (frame.capacity < fb->len)
+    {
+      heap_caps_free(frame.buf);
+      frame.capacity = fb->len + fb->len / 4; // headroom for busier scenes
+      frame.buf = (uint8_t *)heap_caps_malloc(frame.capacity, MALLOC_CAP_SPIRAM);
+      if (frame.buf == nullptr)
+      {
+        Serial.println("Unable to allocate a frame buffer in PSRAM.");
+        frame.capacity = 0;
+        esp_camera_fb_return(fb);
+        release(&frame);
+        vTaskDelay(pdMS_TO_TICKS(100));
+        continue;
+      }
+    }
+
+    memcpy(frame.buf, fb->buf, fb->len);
+    frame.len = fb->len;
+    frame.width = fb->width;
+    frame.height = fb->height;
+    esp_camera_fb_return(fb);
+
+    portENTER_CRITICAL(&_mux);
+    frame.seq = ++_seq;
+    frame.capturedMs = millis();
+    frame.refs = 0;
+    _latest = slot;
+    portEXIT_CRITICAL(&_mux);
+
+    // gaps where nobody was consuming are not frame times
+    uint32_t interval = frame.capturedMs - _lastCaptureMs;
+    if (interval < 1000)
+    {
+      _frameMs = (_frameMs * 3 + interval) / 4;
+    }
+    _lastCaptureMs = frame.capturedMs;
+  }
+}
+
+void FrameBroker::addConsumer()
+{
+  portENTER_CRITICAL(&_mux);
+  _consumers++;
+  portEXIT_CRITICAL(&_mux);
+
+  if (_captureTask != NULL)
+  {
+    xTaskNotifyGive(_captureTask);
+  }
+}
+
+void FrameBroker::removeConsumer()
+{
+  portENTER_CRITICAL(&_mux);
+  _consumers--;
+  portEXIT_CRITICAL(&_mux);
+}
+
+CamFrame *FrameBroker::acquire(uint32_t afterSeq)
+{
+  CamFrame *frame = nullptr;
+  portENTER_CRITICAL(&_mux);
+  if (_latest >= 0 && _frames[_latest].seq > afterSeq)
+  {
+    frame = &_frames[_latest];
+    frame->refs++;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return frame;
+}
+
+CamFrame *FrameBroker::waitFor(uint32_t afterSeq, uint32_t timeoutMs)
+{
+  addConsumer();
+  unsigned long tStart = millis();
+  CamFrame *frame = acquire(afterSeq);
+  while (frame == nullptr && millis() - tStart < timeoutMs)
+  {
+    vTaskDelay(pdMS_TO_TICKS(10));
+    frame = acquire(afterSeq);
+  }
+  removeConsumer();
+  return frame;
+}
+
+void FrameBroker::release(CamFrame *frame)
+{
+  portENTER_CRITICAL(&_mux);
+  frame->refs--;
+  portEXIT_CRITICAL(&_mux);
+}
+
+uint32_t FrameBroker::latestSeq()
+{
+  return _seq;
+}
@@ -0,0 +1,119 @@
+#include "MotionDetector.h"
+#include "img_converters.h"
+#include "esp_heap_caps.h"
+
+#define MOTION_JPEG_SCALE JPG_SCALE_8X
+#define MOTION_SCALE_DIVISOR 8
+#define MOTION_FRAME_TIMEOUT_MS 2000
+
+void runMotionDetector(void *);
+
+void MotionDetector::begin(FrameBroker *frameBroker, SnapshotWriter *snapshotWriter, OnMotionCallback onMotion)
+{
+  _frameBroker = frameBroker;
+  _snapshotWriter = snapshotWriter;
+  _onMotion = onMotion;
+
+  xTaskCreatePinnedToCore(
+      runMotionDetector,
+      "Motion",
+      6144,
+      this,
+      2,
+      NULL,
+      1);
+}
+
+void runMotionDetector(void *parameter)
+{
+  MotionDetector *detector = (MotionDetector *)parameter;
+  for (;;)
+  {
+    detector->loop();
+    vTaskDelay(pdMS_TO_TICKS(CAM_MOTION_INTERVAL_MS));
+  }
+}
+
+void MotionDetector::loop()
+{
+  // always a fresh capture, a frame left over from an earlier sample would hide the motion since
+  CamFrame *frame = _frameBroker->waitFor(_frameBroker->latestSeq(), MOTION_FRAME_TIMEOUT_MS);
+  if (frame == nullptr)
+  {
+    return;
+  }
+
+  uint16_t width, height;
+  bool decoded = toLuma(frame, width, height);
+  _frameBroker->release(frame);
+  if (!decoded)
+  {
+    return;
+  }
+
+  if (_model._stride != width || _model._height != height - height % MOTION_BLOCK_SIZE)
+  {
+    // first frame, or the frame size changed
+    if (!_model.init(width, height))
+    {
+      Serial.println("Unable to allocate the motion background.");
+      return;
+    }
+  }
+
+  uint16_t changedBlocks = _model.update(_luma, CAM_MOTION_PIXEL_THRESHOLD);
+  if (changedBlocks < CAM_MOTION_MIN_BLOCKS || (_lastMotionMs != 0 && millis() - _lastMotionMs < CAM_MOTION_COOLDOWN_MS))
+  {
+    return;
+  }
+
+  _lastMotionMs = millis();
+  Serial.printf("Motion detected in %d blocks.\n", changedBlocks);
+  for (int i = 0; i < CAM_MOTION_BURST; i++)
+  {
+    _snapshotWriter->request();
+  }
+  if (_onMotion != NULL)
+  {
+    _onMotion(changedBlocks);
+  }
+}
+
+// decodes the JPEG at 1/8 scale, so the decoder skips most of the IDCT work,
+// then keeps only the luma of every pixel
+bool MotionDetector::toLuma(CamFrame *frame, uint16_t &width, uint16_t &height)
+{
+  width = frame->width / MOTION_SCALE_DIVISOR;
+  height = frame->height / MOTION_SCALE_DIVISOR;
+  size_t pixels = (size_t)width * height;
+
+  if (_rgbCapacity < pixels)
+  {
+    heap_caps_free(_rgb);
+    free(_luma);
+    _rgb = (uint8_t *)heap_caps_malloc(pixels * 2, MALLOC_CAP_SPIRAM);
+    _luma = (uint8_t *)malloc(pixels);
+    _rgbCapacity = _rgb != nullptr && _luma != nullptr ? pixels : 0;
+    if (_rgbCapacity == 0)
+    {
+      Serial.println("Unable to allocate the motion detection buffers.");
+      return false;
+    }
+  }
+
+  if (!jpg2rgb565(frame->buf, frame->len, _rgb, MOTION_JPEG_SCALE))
+  {
+    return false;
+  }
+
+  // the decoder writes RGB565 big endian; luma ~ (2R + 5G + B) / 8 on 8 bit channels
+  for (size_t i = 0; i < pixels; i++)
+  {
+    uint16_t px = ((uint16_t)_rgb[2 * i] << 8) | _rgb[2 * i + 1];
+    uint32_t r = (px >> 8) & 0xF8;
+    uint32_t g = (px >> 3) & 0xFC;
+    uint32_t b = (px << 3) & 0xF8;
+    _luma[i] = (uint8_t)((2 * r + 5 * g + b) >> 3);
+  }
+  return true;
+}
@@ -0,0 +1,55 @@
+#include "MotionModel.h"
+#include <stdlib.h>
+
+bool MotionModel::init(uint16_t width, uint16_t height)
+{
+  free(_background);
+  _primed = false;
+  _stride = width;
+  _width = width - width % MOTION_BLOCK_SIZE;
+  _height = height - height % MOTION_BLOCK_SIZE;
+  _background = (uint16_t *)calloc((size_t)width * height, sizeof(uint16_t));
+  return _background != nullptr;
+}
+
+uint16_t MotionModel::update(const uint8_t *luma, uint8_t threshold)
+{
+  if (!_primed)
+  {
+    // the first frame becomes the background as it is
+    for (size_t i = 0; i < (size_t)_stride * _height; i++)
+    {
+      _background[i] = (uint16_t)luma[i] << MOTION_BG_SHIFT;
+    }
+    _primed = true;
+    return 0;
+  }
+
+  const uint32_t blockThreshold = (uint32_t)threshold * MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE;
+  uint16_t changedBlocks = 0;
+
+  for (uint16_t by = 0; by < _height; by += MOTION_BLOCK_SIZE)
+  {
+    for (uint16_t bx = 0; bx < _width; bx += MOTION_BLOCK_SIZE)
+    {
+      uint32_t sad = 0;
+      for (uint16_t y = by; y < by + MOTION_BLOCK_SIZE; y++)
+      {
+        const uint8_t *row = luma + (size_t)y * _stride + bx;
+        uint16_t *bgRow = _background + (size_t)y * _stride + bx;
+        for (uint16_t x = 0; x < MOTION_BLOCK_SIZE; x++)
+        {
+          int32_t current = (int32_t)row[x] << MOTION_BG_SHIFT;
+          int32_t diff = current - bgRow[x];
+          sad += (uint32_t)abs(diff) >> MOTION_BG_SHIFT;
+          bgRow[x] += diff >> MOTION_BG_RATE;
+        }
+      }
+      if (sad > blockThreshold)
+      {
+        changedBlocks++;
+      }
+    }
+  }
+  return changedBlocks;
+}
@@ -0,0 +1,284 @@
+#include "RecordingServer.h"
+#include <ArduinoJson.h>
+#include "FS.h"
+#include "SD_MMC.h"
+#include "esp_heap_caps.h"
+#include <time.h>
+
+#define RECORDING_URL_PREFIX "/sd"
+#define RECORDING_LIST_DEFAULT_LIMIT 50
+#define RECORDING_LIST_MAX_LIMIT 100
+
+// the card is read in blocks this large and sent from memory; per-call reads
+// of a TCP window's worth would cost a card command every few kilobytes
+#define RECORDING_READ_AHEAD_SIZE 16384
+
+int _activeDownloads = 0;
+portMUX_TYPE _downloadsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// what a download is in the middle of sending; the file stays open until the
+// response is done or the client goes away
+struct Download
+{
+  File file;
+  uint8_t *buffer = nullptr;
+  size_t buffered = 0;
+  size_t pos = 0;
+
+  ~Download()
+  {
+    if (file)
+    {
+      file.close();
+    }
+    heap_caps_free(buffer);
+    portENTER_CRITICAL(&_downloadsMux);
+    _activeDownloads--;
+    portEXIT_CRITICAL(&_downloadsMux);
+  }
+};
+
+bool reserveDownload()
+{
+  bool reserved = false;
+  portENTER_CRITICAL(&_downloadsMux);
+  if (_activeDownloads < CAM_MAX_DOWNLOADS)
+  {
+    _activeDownloads++;
+    reserved = true;
+  }
+  portEXIT_CRITICAL(&_downloadsMux);
+  return reserved;
+}
+
+size_t fillDownload(Download *download, uint8_t *buffer, size_t maxLen)
+{
+  if (download->pos == download->buffered)
+  {
+    int n = download->file.read(download->buffer, RECORDING_READ_AHEAD_SIZE);
+    if (n <= 0)
+    {
+      return 0;
+    }
+    download->buffered = n;
+    download->pos = 0;
+  }
+
+  size_t n = min(maxLen, download->buffered - download->pos);
+  memcpy(buffer, download->buffer + download->pos, n);
+  download->pos += n;
+  return n;
+}
+
+String contentTypeOf(const String &path)
+{
+  if (path.endsWith(".jpg"))
+  {
+    return "image/jpeg";
+  }
+  if (path.endsWith(".json"))
+  {
+    return "application/json";
+  }
+  if (path.endsWith(".txt") || path.endsWith(".log"))
+  {
+    return "text/plain";
+  }
+  return "application/octet-stream";
+}
+
+String httpDate(time_t t)
+{
+  char date[32];
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return String(date);
+}
+
+// parses "bytes=start-end", "bytes=start-" and "bytes=-suffix"; multiple ranges are not supported
+bool parseRange(const String &header, size_t size, size_t &start, size_t &end)
+{
+  if (!header.startsWith("bytes=") || header.indexOf(',') >= 0 || size == 0)
+  {
+    return false;
+  }
+
+  int dash = header.indexOf('-');
+  if (dash < 0)
+  {
+    return false;
+  }
+  String first = header.substring(6, dash);
+  String last = header.substring(dash + 1);
+
+  if (first.length() == 0)
+  {
+    size_t suffix = strtoul(last.c_str(), NULL, 10);
+    if (suffix == 0)
+    {
+      return false;
+    }
+    start = suffix >= size ? 0 : size - suffix;
+    end = size - 1;
+    return true;
+  }
+
+  start = strtoul(first.c_str(), NULL, 10);
+  end = last.length() > 0 ? strtoul(last.c_str(), NULL, 10) : size - 1;
+  if (end >= size)
+  {
+    end = size - 1;
+  }
+  return start <= end;
+}
+
+void onFileRequest(AsyncWebServerRequest *request)
+{
+  String path = request->url().substring(strlen(RECORDING_URL_PREFIX));
+  if (path.length() == 0 || path.indexOf("..") >= 0)
+  {
+    request->send(400);
+    return;
+  }
+
+  File file = SD_MMC.open(path);
+  if (!file || file.isDirectory())
+  {
+    request->send(404);
+    return;
+  }
+
+  // saved snapshots never change in place, so size and time identify a version
+  size_t size = file.size();
+  time_t lastWrite = file.getLastWrite();
+  String etag = "\"" + String(size, HEX) + "-" + String((uint32_t)lastWrite, HEX) + "\"";
+  String lastModified = httpDate(lastWrite);
+
+  bool notModified = request->hasHeader("If-None-Match")
+                         ? request->header("If-None-Match") == etag
+                         : request->hasHeader("If-Modified-Since") && request->header("If-Modified-Since") == lastModified;
+  if (notModified)
+  {
+    file.close();
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    return;
+  }
+
+  size_t start = 0;
+  size_t end = size - 1;
+  bool partial = false;
+  if (request->hasHeader("Range"))
+  {
+    partial = parseRange(request->header("Range"), size, start, end);
+    if (!partial)
+    {
+      file.close();
+      AsyncWebServerResponse *response = request->beginResponse(416);
+      response->addHeader("Content-Range", "bytes */" + String(size));
+      request->send(response);
+      return;
+    }
+  }
+
+  if (!reserveDownload())
+  {
+    file.close();
+    request->send(503, "text/plain", "Too many downloads");
+    return;
+  }
+
+  Download *download = new Download();
+  download->file = file;
+  download->buffer = (uint8_t *)heap_caps_malloc(RECORDING_READ_AHEAD_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (download->buffer == nullptr || (start > 0 && !download->file.seek(start)))
+  {
+    delete download;
+    request->send(500);
+    return;
+  }
+  request->onDisconnect([download]()
+                        { delete download; });
+
+  size_t length = size == 0 ? 0 : end - start + 1;
+  AsyncWebServerResponse *response = request->beginResponse(
+      contentTypeOf(path),
+      length,
+      [download](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+      { return fillDownload(download, buffer, maxLen); });
+  if (partial)
+  {
+    response->setCode(206);
+    response->addHeader("Content-Range", "bytes " + String(start) + "-" + String(end) + "/" + String(size));
+  }
+  response->addHeader("Accept-Ranges", "bytes");
+  response->addHeader("ETag", etag);
+  response->addHeader("Last-Modified", lastModified);
+  response->addHeader("Cache-Control", "max-age=86400");
+  request->send(response);
+}
+
+void onListRequest(AsyncWebServerRequest *request)
+{
+  String dirPath = request->hasParam("dir") ? request->getParam("dir")->value() : "/";
+  size_t offset = request->hasParam("offset") ? strtoul(request->getParam("offset")->value().c_str(), NULL, 10) : 0;
+  size_t limit = request->hasParam("limit") ? strtoul(request->getParam("limit")->value().c_str(), NULL, 10) : RECORDING_LIST_DEFAULT_LIMIT;
+  limit = constrain(limit, (size_t)1, (size_t)RECORDING_LIST_MAX_LIMIT);
+
+  File dir = SD_MMC.open(dirPath);
+  if (!dir || !dir.isDirectory())
+  {
+    request->send(404);
+    return;
+  }
+
+  DynamicJsonDocument doc(256 + limit * 128);
+  doc["dir"] = dirPath;
+  doc["offset"] = offset;
+  JsonArray entries = doc.createNestedArray("entries");
+
+  size_t index = 0;
+  bool more = false;
+  File entry = dir.openNextFile();
+  while (entry)
+  {
+    if (index >= offset + limit)
+    {
+      more = true;
+      entry.close();
+      break;
+    }
+
+    if (index >= offset)
+    {
+      JsonObject item = entries.createNestedObject();
+      item["name"] = String(entry.name());
+      item["dir"] = entry.isDirectory();
+      if (!entry.isDirectory())
+      {
+        item["size"] = entry.size();
+        item["modified"] = (uint32_t)entry.getLastWrite();
+      }
+    }
+    index++;
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  dir.close();
+
+  doc["count"] = entries.size();
+  doc["more"] = more;
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->addHeader("Cache-Control", "no-cache");
+  serializeJson(doc, *response);
+  request->send(response);
+}
+
+void audp::RecordingServer::begin(AsyncWebServer &_server)
+{
+  _server.on(RECORDING_URL_PREFIX "/list", HTTP_GET, onListRequest);
+  _server.on(RECORDING_URL_PREFIX "/*", HTTP_GET, onFileRequest);
+}
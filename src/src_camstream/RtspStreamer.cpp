@@ -0,0 +1,113 @@
+#include "RtspStreamer.h"
+
+void runRtspStreamer(void *);
+
+audp::SharedFrameStreamer::SharedFrameStreamer(ESPCamHandler *camHandler, u_short width, u_short height)
+    : CStreamer(width, height)
+{
+  _camHandler = camHandler;
+  _width = width;
+  _height = height;
+}
+
+void audp::SharedFrameStreamer::streamImage(uint32_t curMsec)
+{
+  FrameBroker *frameBroker = _camHandler->getFrameBroker();
+  CamFrame *frame = frameBroker->acquire(_lastSeq);
+  if (frame == nullptr)
+  {
+    // the camera has nothing newer than what the sessions already got
+    return;
+  }
+
+  // the frame size follows the active camera profile
+  if (frame->width != _width || frame->height != _height)
+  {
+    _resizedWidth = frame->width;
+    _resizedHeight = frame->height;
+    frameBroker->release(frame);
+    return;
+  }
+
+  _lastSeq = frame->seq;
+  uint32_t tStart = millis();
+  streamFrame(frame->buf, frame->len, curMsec);
+  frameBroker->release(frame);
+  _camHandler->getQualityController()->reportDelivery(millis() - tStart);
+}
+
+void audp::RtspStreamer::begin(ESPCamHandler *camHandler, uint16_t port, uint8_t fps)
+{
+  _camHandler = camHandler;
+  _msPerFrame = 1000 / fps;
+
+  sensor_t *s = esp_camera_sensor_get();
+  framesize_t framesize = s->status.framesize;
+  _streamer = new SharedFrameStreamer(camHandler, resolution[framesize].width, resolution[framesize].height);
+
+  _server = new WiFiServer(port);
+  _server->begin();
+
+  xTaskCreatePinnedToCore(
+      runRtspStreamer,
+      "RTSP",
+      8192,
+      this,
+      4,
+      NULL,
+      0);
+  Serial.printf("RTSP server started on port %d at %d fps.\n", port, fps);
+}
+
+void runRtspStreamer(void *parameter)
+{
+  audp::RtspStreamer *rtspStreamer = (audp::RtspStreamer *)parameter;
+  for (;;)
+  {
+    rtspStreamer->loop();
+  }
+}
+
+void audp::RtspStreamer::loop()
+{
+  static uint32_t lastFrameMs = 0;
+
+  _streamer->handleRequests(0);
+
+  // the capture task only runs while some session is there to watch
+  bool anySessions = _streamer->anySessions();
+  if (anySessions != _consuming)
+  {
+    anySessions ? _camHandler->getFrameBroker()->addConsumer() : _camHandler->getFrameBroker()->removeConsumer();
+    _consuming = anySessions;
+  }
+
+  uint32_t now = millis();
+  if (anySessions && now - lastFrameMs >= _msPerFrame)
+  {
+    _streamer->streamImage(now);
+    lastFrameMs = now;
+    if (_streamer->_resizedWidth != 0)
+    {
+      recreateStreamer(_streamer->_resizedWidth, _streamer->_resizedHeight);
+    }
+  }
+
+  WiFiClient client = _server->available();
+  if (client)
+  {
+    Serial.printf("RTSP client connected from %s\n", client.remoteIP().toString().c_str());
+    _streamer->addSession(client);
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(5));
+}
+
+// the sessions were set up for the old frame size and go with the old
+// streamer, their clients have to connect again
+void audp::RtspStreamer::recreateStreamer(u_short width, u_short height)
+{
+  Serial.printf("RTSP frame size changed to %dx%d, sessions closed.\n", width, height);
+  delete _streamer;
+  _streamer = new SharedFrameStreamer(_camHandler, width, height);
+}
@@ -0,0 +1,242 @@
+#include "SnapshotWriter.h"
+#include "FS.h"
+#include "SD_MMC.h"
+#include "esp_heap_caps.h"
+#include <time.h>
+
+// frames are written through an internal, DMA capable buffer in large chunks;
+// the SD driver would otherwise bounce PSRAM data one sector at a time
+#define SNAPSHOT_IO_BUFFER_SIZE 32768
+#define SNAPSHOT_FRAME_TIMEOUT_MS 2000
+
+// sequence numbers are reserved in blocks so the NVS is not written per snapshot
+#define SNAPSHOT_SEQ_BLOCK 100
+
+void runSnapshotWriter(void *);
+
+bool SnapshotWriter::begin(FrameBroker *frameBroker)
+{
+  _frameBroker = frameBroker;
+  _ioBuffer = (uint8_t *)heap_caps_aligned_alloc(4, SNAPSHOT_IO_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (_ioBuffer == nullptr)
+  {
+    Serial.println("Unable to allocate the snapshot buffer, snapshots are disabled.");
+    return false;
+  }
+  _queue = xQueueCreate(SNAPSHOT_QUEUE_SIZE, sizeof(SnapshotRequest));
+  if (_queue == nullptr)
+  {
+    Serial.println("Unable to create the snapshot queue, snapshots are disabled.");
+    heap_caps_free(_ioBuffer);
+    _ioBuffer = nullptr;
+    return false;
+  }
+
+  _prefs.begin("snapshot", false);
+  _nextSeq = _prefs.getUInt("seq", 0);
+  _reservedSeq = _nextSeq;
+
+  xTaskCreatePinnedToCore(
+      runSnapshotWriter,
+      "Snapshot writer",
+      4096,
+      this,
+      3,
+      NULL,
+      1);
+  return true;
+}
+
+void SnapshotWriter::onPublish(OnSnapshotCallback onPublish)
+{
+  _onPublish = onPublish;
+}
+
+// records which frames are too old for this snapshot, the frame itself is
+// picked by the writer
+bool SnapshotWriter::request(bool publish)
+{
+  if (_queue == nullptr)
+  {
+    return false;
+  }
+
+  SnapshotRequest request = {_frameBroker->latestSeq(), publish};
+  if (xQueueSend(_queue, &request, 0) != pdTRUE)
+  {
+    Serial.println("Snapshot queue is full, request dropped.");
+    return false;
+  }
+  return true;
+}
+
+void runSnapshotWriter(void *parameter)
+{
+  ((SnapshotWriter *)parameter)->writerLoop();
+}
+
+void SnapshotWriter::writerLoop()
+{
+  SnapshotRequest request;
+  for (;;)
+  {
+    xQueueReceive(_queue, &request, portMAX_DELAY);
+
+    // requests queued together must not all get the same frame
+    CamFrame *frame = _frameBroker->waitFor(max(request.afterSeq, _lastFrameSeq), SNAPSHOT_FRAME_TIMEOUT_MS);
+    if (frame == nullptr)
+    {
+      Serial.println("No frame captured for the snapshot.");
+      continue;
+    }
+    _lastFrameSeq = frame->seq;
+
+    String path;
+    unsigned long tStart = millis();
+    bool saved = write(frame, path);
+    if (saved)
+    {
+      Serial.printf("Saved snapshot %s in %lu ms.\n", path.c_str(), millis() - tStart);
+    }
+
+    // published straight from the frame buffer, the frame stays referenced meanwhile
+    if (request.publish && _onPublish != NULL)
+    {
+      _onPublish(frame);
+    }
+    _frameBroker->release(frame);
+    enforceRetention();
+  }
+}
+
+bool SnapshotWriter::write(CamFrame *frame, String &path)
+{
+  time_t now = time(nullptr);
+  struct tm t;
+  gmtime_r(&now, &t);
+
+  char dir[16];
+  char name[48];
+  strftime(dir, sizeof(dir), "/%Y%m%d", &t);
+  int len = strftime(name, sizeof(name), "/%H%M%S_", &t);
+  snprintf(name + len, sizeof(name) - len, "%08u.jpg", (unsigned)takeSeq());
+
+  fs::FS &fs = SD_MMC;
+  if (!fs.exists(dir))
+  {
+    fs.mkdir(dir);
+  }
+  path = String(dir) + name;
+
+  File file = fs.open(path.c_str(), FILE_WRITE);
+  if (!file)
+  {
+    Serial.printf("Failed to open %s in writing mode\n", path.c_str());
+    return false;
+  }
+
+  // seeking past the end allocates the whole cluster chain up front
+  file.seek(frame->len);
+  file.seek(0);
+
+  size_t written = 0;
+  while (written < frame->len)
+  {
+    size_t chunk = min((size_t)SNAPSHOT_IO_BUFFER_SIZE, frame->len - written);
+    memcpy(_ioBuffer, frame->buf + written, chunk);
+    if (file.write(_ioBuffer, chunk) != chunk)
+    {
+      Serial.printf("Failed to write %s\n", path.c_str());
+      break;
+    }
+    written += chunk;
+  }
+  file.close();
+  return written == frame->len;
+}
+
+uint32_t SnapshotWriter::takeSeq()
+{
+  if (_nextSeq >= _reservedSeq)
+  {
+    _reservedSeq = _nextSeq + SNAPSHOT_SEQ_BLOCK;
+    _prefs.putUInt("seq", _reservedSeq);
+  }
+  return _nextSeq++;
+}
+
+void SnapshotWriter::enforceRetention()
+{
+  while (SD_MMC.totalBytes() - SD_MMC.usedBytes() < CAM_SD_MIN_FREE_BYTES)
+  {
+    if (!deleteOldest())
+    {
+      Serial.println("SD card is low on space, but there are no snapshots left to delete.");
+      return;
+    }
+  }
+}
+
+// a snapshot directory is named after its date, YYYYMMDD
+bool isSnapshotDir(const char *name)
+{
+  if (strlen(name) != 8)
+  {
+    return false;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    if (!isdigit(name[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the oldest entry of a directory is the one with the smallest name
+String findOldest(File &dir, bool directories)
+{
+  String oldest = "";
+  File entry = dir.openNextFile();
+  while (entry)
+  {
+    String name = String(entry.name());
+    name = name.substring(name.lastIndexOf('/') + 1);
+    bool candidate = directories ? entry.isDirectory() && isSnapshotDir(name.c_str()) : !entry.isDirectory();
+    if (candidate && (oldest == "" || name < oldest))
+    {
+      oldest = name;
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  return oldest;
+}
+
+bool SnapshotWriter::deleteOldest()
+{
+  fs::FS &fs = SD_MMC;
+  File root = fs.open("/");
+  String oldestDir = findOldest(root, true);
+  root.close();
+  if (oldestDir == "")
+  {
+    return false;
+  }
+
+  String dirPath = "/" + oldestDir;
+  File dir = fs.open(dirPath);
+  String oldestFile = findOldest(dir, false);
+  dir.close();
+
+  if (oldestFile == "")
+  {
+    fs.rmdir(dirPath);
+    return true;
+  }
+
+  String path = dirPath + "/" + oldestFile;
+  Serial.printf("Deleting %s to free up space.\n", path.c_str());
+  return fs.remove(path);
+}
@@ -1,20 +1,197 @@
 #include "WebStreamer.h"
 
+#define STREAM_BOUNDARY "frame"
+#define STREAM_PART_HEADER_MAX_LEN 96
+#define PICTURE_MAX_AGE_MS 200 // a frame this fresh is served to /jpg without waiting
+
 ESPCamHandler *_camHandler;
+FrameBroker *_frameBroker;
+CamQualityController *_qualityController;
+
+// what a viewer of the stream is in the middle of sending; the frame itself
+// is only referenced, never copied
+struct StreamClient
+{
+  CamFrame *frame = nullptr;
+  uint32_t lastSeq = 0;
+  size_t pos = 0;
+  char partHeader[STREAM_PART_HEADER_MAX_LEN];
+  size_t partHeaderLen = 0;
+  unsigned long startedMs = 0;
+};
 
 void audp::WebStreamer::setCamHandler(ESPCamHandler *camHandler)
 {
   _camHandler = camHandler;
+  _frameBroker = camHandler->getFrameBroker();
+  _qualityController = camHandler->getQualityController();
+}
+
+// copies the next piece of a part laid out as header, jpeg, CRLF
+size_t fillPart(StreamClient *client, uint8_t *buffer, size_t maxLen)
+{
+  CamFrame *frame = client->frame;
+  size_t total = client->partHeaderLen + frame->len + 2;
+  size_t written = 0;
+
+  while (written < maxLen && client->pos < total)
+  {
+    size_t n;
+    if (client->pos < client->partHeaderLen)
+    {
+      n = min(maxLen - written, client->partHeaderLen - client->pos);
+      memcpy(buffer + written, client->partHeader + client->pos, n);
+    }
+    else if (client->pos < client->partHeaderLen + frame->len)
+    {
+      size_t offset = client->pos - client->partHeaderLen;
+      n = min(maxLen - written, frame->len - offset);
+      memcpy(buffer + written, frame->buf + offset, n);
+    }
+    else
+    {
+      size_t offset = client->pos - client->partHeaderLen - frame->len;
+      n = min(maxLen - written, (size_t)2 - offset);
+      memcpy(buffer + written, "\r\n" + offset, n);
+    }
+    written += n;
+    client->pos += n;
+  }
+
+  if (client->pos == total)
+  {
+    // a viewer whose connection backs up takes longer than a frame interval here
+    _qualityController->reportDelivery(millis() - client->startedMs);
+    _frameBroker->release(client->frame);
+    client->frame = nullptr;
+  }
+  return written;
+}
+
+// a viewer that is ahead of the camera gets RESPONSE_TRY_AGAIN and is asked
+// again on the next ack or poll of its connection
+size_t fillStream(StreamClient *client, uint8_t *buffer, size_t maxLen)
+{
+  if (client->frame == nullptr)
+  {
+    client->frame = _frameBroker->acquire(client->lastSeq);
+    if (client->frame == nullptr)
+    {
+      return RESPONSE_TRY_AGAIN;
+    }
+
+    client->lastSeq = client->frame->seq;
+    client->pos = 0;
+    client->startedMs = millis();
+    client->partHeaderLen = snprintf(
+        client->partHeader,
+        STREAM_PART_HEADER_MAX_LEN,
+        "--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+        client->frame->len);
+  }
+
+  return fillPart(client, buffer, maxLen);
+}
+
+void onStreamRequest(AsyncWebServerRequest *request)
+{
+  StreamClient *client = new StreamClient();
+  _frameBroker->addConsumer();
+
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "multipart/x-mixed-replace;boundary=" STREAM_BOUNDARY,
+      [client](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+      { return fillStream(client, buffer, maxLen); });
+  response->addHeader("Cache-Control", "no-cache");
+
+  request->onDisconnect([client]()
+                        {
+                          if (client->frame != nullptr)
+                          {
+                            _frameBroker->release(client->frame);
+                          }
+                          _frameBroker->removeConsumer();
+                          delete client; });
+  request->send(response);
+}
+
+// a picture request holds its frame until the response is fully sent
+struct PictureRequest
+{
+  CamFrame *frame = nullptr;
+  uint32_t afterSeq = 0;
+  bool consuming = false;
+};
+
+void releasePicture(PictureRequest *picture)
+{
+  if (picture->frame != nullptr)
+  {
+    _frameBroker->release(picture->frame);
+    picture->frame = nullptr;
+  }
+  if (picture->consuming)
+  {
+    _frameBroker->removeConsumer();
+    picture->consuming = false;
+  }
+}
+
+size_t fillPicture(PictureRequest *picture, uint8_t *buffer, size_t maxLen, size_t index)
+{
+  if (picture->frame == nullptr)
+  {
+    if (index > 0)
+    {
+      return 0;
+    }
+    picture->frame = _frameBroker->acquire(picture->afterSeq);
+    if (picture->frame == nullptr)
+    {
+      return RESPONSE_TRY_AGAIN;
+    }
+  }
+
+  size_t n = min(maxLen, picture->frame->len - index);
+  memcpy(buffer, picture->frame->buf + index, n);
+  if (index + n == picture->frame->len)
+  {
+    releasePicture(picture);
+  }
+  return n;
 }
 
 void onPictureRequest(AsyncWebServerRequest *request)
 {
-  OV2640 *cam = _camHandler->getCam();
-  cam->run();
-  request->send_P(200, "image/jpeg", cam->getfb(), cam->getSize());
+  PictureRequest *picture = new PictureRequest();
+  request->onDisconnect([picture]()
+                        {
+                          releasePicture(picture);
+                          delete picture; });
+
+  // reuse what a running stream just captured, otherwise wait for a new capture
+  CamFrame *frame = _frameBroker->acquire();
+  if (frame != nullptr && millis() - frame->capturedMs <= PICTURE_MAX_AGE_MS)
+  {
+    picture->frame = frame;
+    request->send("image/jpeg", frame->len, [picture](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                  { return fillPicture(picture, buffer, maxLen, index); });
+    return;
+  }
+
+  if (frame != nullptr)
+  {
+    picture->afterSeq = frame->seq;
+    _frameBroker->release(frame);
+  }
+  picture->consuming = true;
+  _frameBroker->addConsumer();
+  request->sendChunked("image/jpeg", [picture](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                       { return fillPicture(picture, buffer, maxLen, index); });
 }
 
 void audp::WebStreamer::begin(AsyncWebServer &_server)
 {
   _server.on("/jpg", HTTP_GET, onPictureRequest);
+  _server.on("/stream", HTTP_GET, onStreamRequest);
 }
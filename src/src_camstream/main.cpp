@@ -10,6 +10,9 @@
 #include "CommunicationManager.h"
 #include "ESPCamHandler.h"
 #include "WebStreamer.h"
+#include "RtspStreamer.h"
+#include "MotionDetector.h"
+#include "RecordingServer.h"
 
 #define TEN_MIN_IN_MS 600000
 
@@ -17,9 +20,12 @@ Config config;
 CamStreamConfig camConfig;
 MqttHandler mqttHandler;
 CamStreamCommunicationManager commMgr;
-SensorHandler sensorHandler;
+SensorHandler<AHT21Sensor> sensorHandler;
 ESPCamHandler camHandler;
 audp::WebStreamer webStreamer;
+audp::RtspStreamer rtspStreamer;
+MotionDetector motionDetector;
+audp::RecordingServer recordingServer;
 AsyncWebServer server(80);
 
 bool setupComplete = false;
@@ -51,7 +57,17 @@ void setup()
   connectToWifi();
   delay(500);
 
-  mqttHandler.init(config.mqtt_config);
+  // snapshots are filed by UTC date once the clock is synced
+  configTime(0, 0, "pool.ntp.org");
+
+  if (!mqttHandler.init(config.mqtt_config))
+  {
+    // nothing can be published or received without the topics
+    for (;;)
+    {
+      delay(1000);
+    }
+  }
   delay(500);
 
   mqttHandler.connect();
@@ -65,11 +81,22 @@ void setup()
   initSD();
 
   camHandler.init();
+  camHandler.getSnapshotWriter()->onPublish([](CamFrame *frame)
+                                             { commMgr.publishPicture(frame->buf, frame->len, frame->seq); });
+  camHandler.startCapture();
   delay(500);
 
   startWebServer();
   delay(500);
 
+  rtspStreamer.begin(&camHandler);
+
+  motionDetector.begin(
+      camHandler.getFrameBroker(),
+      camHandler.getSnapshotWriter(),
+      [](uint16_t changedBlocks)
+      { commMgr.publishMotion(changedBlocks); });
+
   setupComplete = true;
 }
 
@@ -81,6 +108,7 @@ void loop()
   }
 
   sensorHandler.publishAll();
+  deviceState.publish(&mqttHandler);
   delay(TEN_MIN_IN_MS);
 }
 
@@ -110,6 +138,12 @@ void onPictureRequest()
   camHandler.takePicAndSave();
 }
 
+// the payload is the name of the profile, e.g. snapshot, stream or night
+void onProfileRequest(const char *payload)
+{
+  camHandler.getQualityController()->requestProfile(payload);
+}
+
 void blinkLED(void *parameter)
 {
   bool *setupComplete = (bool *)parameter;
@@ -133,7 +167,7 @@ void startWebServer()
   webStreamer.setCamHandler(&camHandler);
   webStreamer.begin(server);
 
-  // server.serveStatic("/", SD_MMC, "/");
+  recordingServer.begin(server);
   server.begin();
 }
 
@@ -158,16 +192,17 @@ void initCommMgr()
 {
   commMgr.init(
       &mqttHandler,
-      camConfig,
-      [](std::string payload)
+      [](const char *payload, size_t length)
       { onRestartRequest(); },
-      [](std::string payload)
-      { onPictureRequest(); });
+      [](const char *payload, size_t length)
+      { onPictureRequest(); },
+      [](const char *payload, size_t length)
+      { onProfileRequest(payload); });
 }
 
 void initSensorHandler()
 {
-  TemperatureSensorConfig tempSensorConfig = TemperatureSensorConfig(AHT21);
+  TemperatureSensorConfig tempSensorConfig;
   tempSensorConfig.SCLPin = camConfig.SCLPin;
   tempSensorConfig.SDAPin = camConfig.SDAPin;
   sensorHandler.init(tempSensorConfig, &commMgr);
@@ -0,0 +1,187 @@
+#include "AudioDsp.h"
+#include <math.h>
+
+#define DSP_SAMPLE_MAX 32767
+#define DSP_LIMIT_THRESHOLD 26214 // -2 dBFS, the limiter is transparent below this
+#define DSP_VOLUME_STEPS 21
+#define DSP_VOLUME_STEP_DB 2.0f
+#define DSP_MAX_TRACK_GAIN_DB 12.0f
+#define DSP_MIN_MEASURED_FRAMES 441000 // 10s at 44.1 kHz
+
+// band centers of the bass/mid/treble EQ
+const float eqFrequencies[DSP_EQ_BANDS] = {100.0f, 1000.0f, 8000.0f};
+const BiquadType eqTypes[DSP_EQ_BANDS] = {LowShelf, Peaking, HighShelf};
+
+int32_t toGain(float db)
+{
+  return (int32_t)lroundf(powf(10.0f, db / 20.0f) * (1 << DSP_GAIN_SHIFT));
+}
+
+int32_t toCoeff(float value)
+{
+  return (int32_t)lroundf(value * (1 << DSP_COEFF_SHIFT));
+}
+
+// RBJ audio EQ cookbook filters, quantized to Q28
+void Biquad::design(BiquadType type, float sampleRate, float freq, float gainDb, float q)
+{
+  bypass = fabsf(gainDb) < 0.1f;
+  if (bypass)
+  {
+    return;
+  }
+
+  float a = powf(10.0f, gainDb / 40.0f);
+  float w0 = 2.0f * (float)M_PI * freq / sampleRate;
+  float cosw = cosf(w0);
+  float alpha = sinf(w0) / (2.0f * q);
+  float sqrtA2alpha = 2.0f * sqrtf(a) * alpha;
+  float nb0, nb1, nb2, na0, na1, na2;
+
+  switch (type)
+  {
+  case LowShelf:
+    nb0 = a * ((a + 1) - (a - 1) * cosw + sqrtA2alpha);
+    nb1 = 2 * a * ((a - 1) - (a + 1) * cosw);
+    nb2 = a * ((a + 1) - (a - 1) * cosw - sqrtA2alpha);
+    na0 = (a + 1) + (a - 1) * cosw + sqrtA2alpha;
+    na1 = -2 * ((a - 1) + (a + 1) * cosw);
+    na2 = (a + 1) + (a - 1) * cosw - sqrtA2alpha;
+    break;
+  case HighShelf:
+    nb0 = a * ((a + 1) + (a - 1) * cosw + sqrtA2alpha);
+    nb1 = -2 * a * ((a - 1) + (a + 1) * cosw);
+    nb2 = a * ((a + 1) + (a - 1) * cosw - sqrtA2alpha);
+    na0 = (a + 1) - (a - 1) * cosw + sqrtA2alpha;
+    na1 = 2 * ((a - 1) - (a + 1) * cosw);
+    na2 = (a + 1) - (a - 1) * cosw - sqrtA2alpha;
+    break;
+  default:
+    nb0 = 1 + alpha * a;
+    nb1 = -2 * cosw;
+    nb2 = 1 - alpha * a;
+    na0 = 1 + alpha / a;
+    na1 = -2 * cosw;
+    na2 = 1 - alpha / a;
+    break;
+  }
+
+  b0 = toCoeff(nb0 / na0);
+  b1 = toCoeff(nb1 / na0);
+  b2 = toCoeff(nb2 / na0);
+  a1 = toCoeff(na1 / na0);
+  a2 = toCoeff(na2 / na0);
+}
+
+void AudioDsp::setSampleRate(uint32_t sampleRate)
+{
+  _sampleRate = sampleRate;
+  setEq(_eqDb[0], _eqDb[1], _eqDb[2]);
+}
+
+void AudioDsp::setEq(float bassDb, float midDb, float trebleDb)
+{
+  float gains[DSP_EQ_BANDS] = {bassDb, midDb, trebleDb};
+  for (int band = 0; band < DSP_EQ_BANDS; band++)
+  {
+    _eqDb[band] = gains[band];
+    _eq[band].design(eqTypes[band], _sampleRate, eqFrequencies[band], gains[band], 0.707f);
+  }
+}
+
+// 0-21 like the decoder's volume, but 2 dB per step and smoothed per frame
+void AudioDsp::setVolume(uint8_t volume)
+{
+  if (volume == 0)
+  {
+    _volumeTarget = 0;
+    return;
+  }
+  _volumeTarget = toGain(-DSP_VOLUME_STEP_DB * (DSP_VOLUME_STEPS - volume));
+}
+
+void AudioDsp::beginTrack(int16_t gainCentiDb)
+{
+  _trackGain = toGain(gainCentiDb / 100.0f);
+  _sumSquares = 0;
+  _measuredFrames = 0;
+}
+
+// gain that brings the track just played to the target RMS level
+bool AudioDsp::measureTrackGain(float targetDbfs, int16_t &gainCentiDb)
+{
+  if (_measuredFrames < DSP_MIN_MEASURED_FRAMES)
+  {
+    return false;
+  }
+
+  float meanSquare = (float)_sumSquares / (2.0f * _measuredFrames);
+  float rmsDbfs = 10.0f * log10f(meanSquare / ((float)DSP_SAMPLE_MAX * DSP_SAMPLE_MAX) + 1e-12f);
+  float gainDb = targetDbfs - rmsDbfs;
+  gainDb = fmaxf(-DSP_MAX_TRACK_GAIN_DB, fminf(DSP_MAX_TRACK_GAIN_DB, gainDb));
+  gainCentiDb = (int16_t)lroundf(gainDb * 100.0f);
+  return true;
+}
+
+inline int32_t runBiquad(const Biquad &f, BiquadState &s, int32_t x)
+{
+  int64_t acc = (int64_t)f.b0 * x + (int64_t)f.b1 * s.x1 + (int64_t)f.b2 * s.x2 - (int64_t)f.a1 * s.y1 - (int64_t)f.a2 * s.y2;
+  int32_t y = (int32_t)(acc >> DSP_COEFF_SHIFT);
+  s.x2 = s.x1;
+  s.x1 = x;
+  s.y2 = s.y1;
+  s.y1 = y;
+  return y;
+}
+
+// unity below the threshold, then bends smoothly towards full scale
+inline int16_t softLimit(int32_t x)
+{
+  int32_t mag = x < 0 ? -x : x;
+  if (mag <= DSP_LIMIT_THRESHOLD)
+  {
+    return (int16_t)x;
+  }
+
+  const int32_t headroom = DSP_SAMPLE_MAX - DSP_LIMIT_THRESHOLD;
+  int32_t over = mag - DSP_LIMIT_THRESHOLD;
+  int32_t limited = DSP_LIMIT_THRESHOLD + (int32_t)((int64_t)over * headroom / (over + headroom));
+  return (int16_t)(x < 0 ? -limited : limited);
+}
+
+void AudioDsp::process(int16_t *frames, size_t count)
+{
+  int32_t volumeGain = _volumeGain;
+  uint64_t sumSquares = 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    // one pole smoothing of the volume so steps never click
+    volumeGain += (_volumeTarget - volumeGain) >> 8;
+    if (volumeGain != _volumeTarget && (_volumeTarget - volumeGain) >> 8 == 0)
+    {
+      volumeGain = _volumeTarget;
+    }
+    int32_t gain = (_trackGain * volumeGain) >> DSP_GAIN_SHIFT;
+
+    for (int ch = 0; ch < 2; ch++)
+    {
+      int32_t x = frames[2 * i + ch];
+      sumSquares += (uint32_t)(x * x);
+
+      int32_t v = (x * gain) >> DSP_GAIN_SHIFT;
+      for (int band = 0; band < DSP_EQ_BANDS; band++)
+      {
+        if (!_eq[band].bypass)
+        {
+          v = runBiquad(_eq[band], _eqState[band][ch], v);
+        }
+      }
+      frames[2 * i + ch] = softLimit(v);
+    }
+  }
+
+  _volumeGain = volumeGain;
+  _sumSquares += sumSquares;
+  _measuredFrames += count;
+}
@@ -2,107 +2,485 @@
 #include "Audio.h"
 #include "AudioPlayer.h"
 #include "AudioSource.h"
+#include "CommandQueue.h"
+#include "Fnv1a.h"
+#include "AudioDsp.h"
+#include "LibraryIndex.h"
 #include <esp_random.h>
+#include <climits>
 #include <list>
 #include "Config.h"
 
-int volume = 10; // default volume
+#define AUDIO_GENRE_MAX_LEN 48
+#define AUDIO_TITLE_MAX_LEN 128
+#define AUDIO_COMMAND_QUEUE_SIZE 16
+
+// one volume step per interval, so a change from 0 to 21 fades in over ~0.4s
+#define AUDIO_VOLUME_RAMP_STEP_MS 20
+// a genre change waits for the requests to settle before restarting playback
+#define AUDIO_GENRE_DEBOUNCE_MS 300
+// state changes within the window are sent as one publish
+#define AUDIO_STATE_BATCH_MS 150
+#define AUDIO_STATE_MIN_INTERVAL_MS 500
+
+// fields of the state model, in the order of stateFieldNames; only changed
+// ones are published, and the genre menu only when it changed
+#define AUDIO_STATE_IS_ON 0x01
+#define AUDIO_STATE_VOLUME 0x02
+#define AUDIO_STATE_TITLE 0x04
+#define AUDIO_STATE_UNDERRUNS 0x08
+#define AUDIO_STATE_FIELD_COUNT 4
+#define AUDIO_STATE_MENU 0x10
+#define AUDIO_STATE_FIELD_MAX_LEN 320 // quotes and escapes make the text longer than the value
+#define AUDIO_STATE_MENU_MAX_LEN 768
+
+// loudness every track is normalized to, and the default EQ of the DSP stage
+#ifndef AUDIO_NORMALIZE_TARGET_DBFS
+#define AUDIO_NORMALIZE_TARGET_DBFS -18.0f
+#endif
+// loudness ReplayGain tags normalize to
+#define AUDIO_REPLAY_GAIN_REFERENCE_DBFS -18.0f
+#ifndef AUDIO_EQ_BASS_DB
+#define AUDIO_EQ_BASS_DB 0
+#endif
+#ifndef AUDIO_EQ_MID_DB
+#define AUDIO_EQ_MID_DB 0
+#endif
+#ifndef AUDIO_EQ_TREBLE_DB
+#define AUDIO_EQ_TREBLE_DB 0
+#endif
+
+// the decoder stays at unity gain, volume is applied by the DSP stage
+#define AUDIO_DECODER_UNITY_VOLUME 21
+
+int volume = 10;        // default volume, the target of the volume ramp
+int appliedVolume = 10; // what the decoder currently plays at
+
+enum AudioCommandType
+{
+  SetVolume,
+  SetState,
+  SetGenre
+};
+
+// requests from the network side, applied by the audio task only
+struct AudioCommand
+{
+  AudioCommandType type;
+  int value;
+  char genre[AUDIO_GENRE_MAX_LEN];
+};
+
+// latest value of each request kind not applied yet, so a burst of
+// requests collapses into its last value
+struct PendingControls
+{
+  int state = -1;
+  bool hasGenre = false;
+  char genre[AUDIO_GENRE_MAX_LEN];
+  unsigned long genreRequestedMs = 0;
+};
+
+// the state as last published, and the fields changed since; a requested
+// publish compares the live values with it once the batch window is over
+struct PlayerState
+{
+  bool isOn = false;
+  int volume = -1;
+  char title[AUDIO_TITLE_MAX_LEN] = "";
+  uint32_t underruns = 0;
+
+  uint8_t dirty = 0;
+  bool requested = false;
+  unsigned long requestedMs = 0;
+  unsigned long lastPublishMs = 0;
+  uint32_t menuHash = 0; // of the last menu sent, so an identical one is not sent again
+};
+
+const char *const stateFieldNames[AUDIO_STATE_FIELD_COUNT] = {"is_on", "volume", "title", "underruns"};
 
 Audio audio;
 AudioMenu audioMenu;
 AudioSource *audioSource;
 PublishState publishStateFn;
+CommandQueue<AudioCommand, AUDIO_COMMAND_QUEUE_SIZE> commandQueue;
+TaskHandle_t audioTaskHandle = NULL;
+PendingControls pendingControls;
+PlayerState playerState;
+AudioDsp audioDsp;
+LibraryIndex libraryIndex;
+String currentTrack;
+TrackMetadata currentMetadata; // of the playing track, from the library index
 
 void playRandomSong();
+void storeMeasuredGain();
+void enqueueCommand(AudioCommand &);
+void coalesceCommand(AudioCommand &, unsigned long now);
+void rampVolume(unsigned long now);
+void requestStatePublish(const char *title = NULL, bool menuChanged = false);
+void flushState(unsigned long now);
+TickType_t ticksUntilNextWork(unsigned long now);
+
+// each field on its own, as a JSON value; no title is null
+void setStateField(JsonDocument &doc, uint8_t field)
+{
+  switch (field)
+  {
+  case AUDIO_STATE_IS_ON:
+    doc.set(playerState.isOn);
+    break;
+  case AUDIO_STATE_VOLUME:
+    doc.set(playerState.volume);
+    break;
+  case AUDIO_STATE_TITLE:
+    if (playerState.title[0] != 0)
+    {
+      doc.set((const char *)playerState.title);
+    }
+    break;
+  default:
+    doc.set(playerState.underruns);
+    break;
+  }
+}
 
-void publishState(bool isRunning, int volume, const char *title = NULL, AudioMenu *audioMenu = NULL)
+// returns the fields that could not be sent
+uint8_t publishFields(uint8_t fields)
 {
-  if (publishStateFn != NULL)
+  uint8_t unsent = 0;
+  for (uint8_t i = 0; i < AUDIO_STATE_FIELD_COUNT; i++)
   {
-    DynamicJsonDocument doc(512);
-    doc["is_on"] = isRunning;
-    doc["volume"] = volume;
-    doc["title"] = title;
+    uint8_t field = 1 << i;
+    if (!(fields & field))
+    {
+      continue;
+    }
 
-    if (audioMenu != NULL)
+    StaticJsonDocument<16> doc;
+    setStateField(doc, field);
+    char payload[AUDIO_STATE_FIELD_MAX_LEN];
+    size_t length = serializeJson(doc, payload);
+    if (publishStateFn(stateFieldNames[i], payload, length) == 0)
     {
-      JsonObject audioMenuObj = doc.createNestedObject("audio_menu");
-      audioMenuObj["selected_genre"] = audioMenu->selectedGenre;
-
-      JsonArray genres = audioMenuObj.createNestedArray("genres");
-      for (auto genre : audioMenu->getGenres())
-      {
-        genres.add(genre);
-      }
+      unsent |= field;
     }
+  }
+  return unsent;
+}
+
+// false if the menu differs from the last one sent and could not be sent either
+bool publishMenu()
+{
+  StaticJsonDocument<512> doc;
+  JsonObject audioMenuObj = doc.createNestedObject("audio_menu");
+  audioMenuObj["selected_genre"] = audioMenu.selectedGenre;
+  JsonArray genres = audioMenuObj.createNestedArray("genres");
+  for (auto &genreEntry : audioMenu.audioMap)
+  {
+    genres.add(genreEntry.first);
+  }
 
-    String payload;
-    serializeJson(doc, payload);
-    publishStateFn(payload);
-    delay(500);
+  char payload[AUDIO_STATE_MENU_MAX_LEN];
+  size_t length = serializeJson(doc, payload);
+  uint32_t hash = fnv1aBytes(payload, length);
+  if (hash == playerState.menuHash)
+  {
+    return true;
+  }
+  if (publishStateFn(NULL, payload, length) == 0)
+  {
+    return false;
   }
+  playerState.menuHash = hash;
+  return true;
 }
 
 void AudioPlayer::init()
 {
-  audioSource = new SDAudioSource();
+  init(new SDAudioSource());
+}
+
+void AudioPlayer::init(AudioSource *source)
+{
+  audioSource = source;
   // Connect MAX98357 I2S Amplifier Module
   audio.setPinout(spConfig.I2S_BCLK, spConfig.I2S_LRC, spConfig.I2S_DOUT);
   // Set thevolume (0-21)
-  audio.setVolume(volume);
+  audio.setVolume(AUDIO_DECODER_UNITY_VOLUME);
+  audioDsp.setEq(AUDIO_EQ_BASS_DB, AUDIO_EQ_MID_DB, AUDIO_EQ_TREBLE_DB);
+  audioDsp.setVolume(volume);
 }
 
 // only meant for external callers, internal func should use `playRandomSong`
 // since playlist should already be populated
 void AudioPlayer::start()
 {
+  audioTaskHandle = xTaskGetCurrentTaskHandle();
   audioSource->populateAudioMenu(audioMenu);
-  publishState(audioSource->isRunning, volume, NULL, &audioMenu);
+  if (audioSource->getLibraryFS() != NULL)
+  {
+    libraryIndex.load(*audioSource->getLibraryFS());
+
+    // only tracks added since the last start are read here
+    unsigned long tStart = millis();
+    size_t indexed = 0;
+    for (auto &genreEntry : audioMenu.audioMap)
+    {
+      indexed += libraryIndex.indexMetadata(genreEntry.second);
+    }
+    if (indexed > 0)
+    {
+      Serial.printf("Indexed metadata of %d tracks in %lu ms.\n", indexed, millis() - tStart);
+    }
+  }
+  requestStatePublish(NULL, true);
 }
 
+// must only run on the audio task, which is the only one touching the decoder
 void AudioPlayer::loop()
 {
+  unsigned long now = millis();
+  AudioCommand cmd;
+  while (commandQueue.pop(cmd))
+  {
+    coalesceCommand(cmd, now);
+  }
+
+  applyPendingControls(now);
+  rampVolume(now);
+  flushState(now);
+
+  if (audio.getSampleRate() != 0 && audio.getSampleRate() != audioDsp._sampleRate)
+  {
+    audioDsp.setSampleRate(audio.getSampleRate());
+  }
+
   audio.loop();
-  if (!audio.isRunning())
+
+  // a command wakes the task right away; otherwise it sleeps until the next timed work
+  ulTaskNotifyTake(pdTRUE, ticksUntilNextWork(millis()));
+}
+
+void coalesceCommand(AudioCommand &cmd, unsigned long now)
+{
+  switch (cmd.type)
+  {
+  case SetVolume:
   {
-    delay(1000);
+    // the ramp picks up the new target on its next step
+    volume = cmd.value;
+    requestStatePublish();
+    break;
+  }
+  case SetState:
+  {
+    pendingControls.state = cmd.value;
+    break;
+  }
+  case SetGenre:
+  {
+    pendingControls.hasGenre = true;
+    strlcpy(pendingControls.genre, cmd.genre, AUDIO_GENRE_MAX_LEN);
+    pendingControls.genreRequestedMs = now;
+    break;
+  }
   }
 }
 
-void AudioPlayer::onVolumeChangeRequested(std::string payload)
+void AudioPlayer::applyPendingControls(unsigned long now)
 {
-  int vol = std::stoi(payload);
-  volume = vol;
-  audio.setVolume(vol);
-  Serial.printf("Audio volume changed to %d\n", vol);
+  if (pendingControls.state >= 0)
+  {
+    pendingControls.state ? resume() : pause();
+    pendingControls.state = -1;
+    requestStatePublish();
+  }
+
+  if (pendingControls.hasGenre && now - pendingControls.genreRequestedMs >= AUDIO_GENRE_DEBOUNCE_MS)
+  {
+    pendingControls.hasGenre = false;
+    if (audioMenu.selectedGenre == pendingControls.genre && audio.isRunning())
+    {
+      // already playing the requested genre, nothing to restart
+      return;
+    }
+
+    audio.stopSong();
+    audioSource->selectGenre(audioMenu, String(pendingControls.genre));
+    Serial.printf("Playlist refreshed with %d songs in genre %s.\n", audioMenu.getAudiosInSelectedGenre().size(), audioMenu.selectedGenre.c_str());
+    if (audioSource->isRunning)
+    {
+      playRandomSong();
+    }
+    requestStatePublish(NULL, true);
+  }
 }
 
-void AudioPlayer::onStateChangeRequested(std::string payload)
+void rampVolume(unsigned long now)
 {
-  if (strcmp(payload.c_str(), "off") == 0)
+  static unsigned long lastStepMs = 0;
+  if (appliedVolume == volume || !audioSource->isRunning || now - lastStepMs < AUDIO_VOLUME_RAMP_STEP_MS)
   {
-    pause();
     return;
   }
 
-  if (strcmp(payload.c_str(), "on") == 0)
+  appliedVolume += appliedVolume < volume ? 1 : -1;
+  audioDsp.setVolume(appliedVolume);
+  lastStepMs = now;
+  if (appliedVolume == volume)
+  {
+    Serial.printf("Audio volume changed to %d\n", volume);
+  }
+}
+
+void requestStatePublish(const char *title, bool menuChanged)
+{
+  if (title != NULL && strncmp(playerState.title, title, AUDIO_TITLE_MAX_LEN - 1) != 0)
+  {
+    strlcpy(playerState.title, title, AUDIO_TITLE_MAX_LEN);
+    playerState.dirty |= AUDIO_STATE_TITLE;
+  }
+  if (menuChanged)
+  {
+    playerState.dirty |= AUDIO_STATE_MENU;
+  }
+  if (!playerState.requested)
+  {
+    playerState.requestedMs = millis();
+  }
+  playerState.requested = true;
+}
+
+// marks the fields whose live value differs from the published one
+void syncPlayerState()
+{
+  if (playerState.isOn != audioSource->isRunning)
+  {
+    playerState.isOn = audioSource->isRunning;
+    playerState.dirty |= AUDIO_STATE_IS_ON;
+  }
+  if (playerState.volume != volume)
+  {
+    playerState.volume = volume;
+    playerState.dirty |= AUDIO_STATE_VOLUME;
+  }
+  uint32_t underruns = audioSource->getUnderrunCount();
+  if (playerState.underruns != underruns)
+  {
+    playerState.underruns = underruns;
+    playerState.dirty |= AUDIO_STATE_UNDERRUNS;
+  }
+}
+
+// every changed field goes out retained on its own topic, so a new subscriber
+// starts from the current values without the genre menu being sent along; the
+// menu is only sent when it changed. Whatever could not be sent is tried again.
+void flushState(unsigned long now)
+{
+  if (!playerState.requested ||
+      now - playerState.requestedMs < AUDIO_STATE_BATCH_MS ||
+      now - playerState.lastPublishMs < AUDIO_STATE_MIN_INTERVAL_MS)
+  {
+    return;
+  }
+
+  syncPlayerState();
+  uint8_t dirty = playerState.dirty;
+  playerState.requested = false;
+  playerState.dirty = 0;
+  if (publishStateFn == nullptr || dirty == 0)
   {
-    resume();
     return;
   }
 
-  Serial.printf("Unable to identify payload: %s\n", payload);
+  uint8_t unsent = publishFields(dirty & ~AUDIO_STATE_MENU);
+  if ((dirty & AUDIO_STATE_MENU) && !publishMenu())
+  {
+    unsent |= AUDIO_STATE_MENU;
+  }
+  if (unsent != 0)
+  {
+    playerState.dirty |= unsent;
+    playerState.requested = true;
+    playerState.requestedMs = now;
+  }
+  playerState.lastPublishMs = now;
+}
+
+TickType_t ticksUntilNextWork(unsigned long now)
+{
+  if (audio.isRunning())
+  {
+    return 1;
+  }
+
+  unsigned long waitMs = ULONG_MAX;
+  if (appliedVolume != volume && audioSource->isRunning)
+  {
+    waitMs = AUDIO_VOLUME_RAMP_STEP_MS;
+  }
+  if (pendingControls.hasGenre)
+  {
+    waitMs = min(waitMs, (unsigned long)AUDIO_GENRE_DEBOUNCE_MS);
+  }
+  if (playerState.requested)
+  {
+    waitMs = min(waitMs, (unsigned long)AUDIO_STATE_BATCH_MS);
+  }
+  return waitMs == ULONG_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitMs);
 }
 
-void AudioPlayer::onGenreChangeRequested(std::string payload)
+// the request handlers below run on the MQTT task, or on the loop task when a
+// rule fires them, and only hand the request over to the audio task
+
+void AudioPlayer::onVolumeChangeRequested(const char *payload, size_t length)
 {
-  audio.stopSong();
-  audioMenu.selectedGenre = String(payload.c_str());
-  Serial.printf("Playlist refreshed with %d songs in genre %s.\n", audioMenu.getAudiosInSelectedGenre().size(), audioMenu.selectedGenre.c_str());
-  playRandomSong();
+  AudioCommand cmd{SetVolume};
+  cmd.value = constrain(atoi(payload), 0, 21);
+  enqueueCommand(cmd);
 }
 
-void AudioPlayer::setPublishStateFn(PublishState fn)
+void AudioPlayer::onStateChangeRequested(const char *payload, size_t length)
+{
+  AudioCommand cmd{SetState};
+  if (strcmp(payload, "off") == 0)
+  {
+    cmd.value = 0;
+  }
+  else if (strcmp(payload, "on") == 0)
+  {
+    cmd.value = 1;
+  }
+  else
+  {
+    Serial.printf("Unable to identify payload: %s\n", payload);
+    return;
+  }
+  enqueueCommand(cmd);
+}
+
+void AudioPlayer::onGenreChangeRequested(const char *payload, size_t length)
+{
+  AudioCommand cmd{SetGenre};
+  strlcpy(cmd.genre, payload, AUDIO_GENRE_MAX_LEN);
+  enqueueCommand(cmd);
+}
+
+void enqueueCommand(AudioCommand &cmd)
+{
+  if (!commandQueue.push(cmd))
+  {
+    Serial.println("Audio command queue is full, command dropped.");
+    return;
+  }
+
+  if (audioTaskHandle != NULL)
+  {
+    xTaskNotifyGive(audioTaskHandle);
+  }
+}
+
+void AudioPlayer::setPublishStateFn(const PublishState &fn)
 {
   publishStateFn = fn;
 }
@@ -113,7 +491,8 @@ void AudioPlayer::pause()
   {
     // stream cannot be stopped, so we simply set volume to 0 to
     // mute the music; the next song will not be played after this
-    audio.setVolume(0);
+    appliedVolume = 0;
+    audioDsp.setVolume(0);
     audio.pauseResume();
     audioSource->pause();
     Serial.println("Audio paused.");
@@ -126,10 +505,11 @@ void AudioPlayer::resume()
   // since audioSource may simply be muted previously
   if (!audioSource->isRunning)
   {
-    audio.setVolume(volume);
+    // a muted stream is still decoding; the volume ramp only runs on a
+    // running source, so resume it either way to fade back in
+    audioSource->resume();
     if (!audio.isRunning())
     {
-      audioSource->resume();
       playRandomSong();
     }
     Serial.println("Audio started.");
@@ -138,7 +518,7 @@ void AudioPlayer::resume()
 
 void playRandomSong()
 {
-  auto playlist = audioMenu.getAudiosInSelectedGenre();
+  auto &playlist = audioMenu.getAudiosInSelectedGenre();
   if (playlist.size() == 0)
   {
     Serial.println("No song in the playlist.");
@@ -150,9 +530,56 @@ void playRandomSong()
   std::advance(l_front, idx);
 
   String path = "" + *l_front;
+  int16_t gainCentiDb = 0;
+  if (!libraryIndex.findMetadata(path, currentMetadata))
+  {
+    currentMetadata.title[0] = '\0';
+    currentMetadata.replayGainCentiDb = TRACK_NO_REPLAY_GAIN;
+  }
+
+  // a ReplayGain tag is used as it is, otherwise what was measured on an earlier play
+  if (currentMetadata.replayGainCentiDb != TRACK_NO_REPLAY_GAIN)
+  {
+    gainCentiDb = currentMetadata.replayGainCentiDb + (int16_t)lroundf((AUDIO_NORMALIZE_TARGET_DBFS - AUDIO_REPLAY_GAIN_REFERENCE_DBFS) * 100);
+  }
+  else
+  {
+    libraryIndex.findGain(path, gainCentiDb);
+  }
+  audioDsp.beginTrack(gainCentiDb);
+  currentTrack = path;
+  if (currentMetadata.title[0] != '\0')
+  {
+    requestStatePublish(currentMetadata.title);
+  }
   audioSource->play(path, &audio);
 }
 
+// only called when a track played to its end, so the measurement covers all of it
+void storeMeasuredGain()
+{
+  int16_t gainCentiDb;
+  int16_t knownGainCentiDb;
+  if (currentTrack == "" || currentMetadata.replayGainCentiDb != TRACK_NO_REPLAY_GAIN ||
+      libraryIndex.findGain(currentTrack, knownGainCentiDb))
+  {
+    return;
+  }
+
+  if (audioDsp.measureTrackGain(AUDIO_NORMALIZE_TARGET_DBFS, gainCentiDb))
+  {
+    libraryIndex.storeGain(currentTrack, gainCentiDb);
+    Serial.printf("Normalization gain of %s: %d.%02d dB\n", currentTrack.c_str(), gainCentiDb / 100, abs(gainCentiDb % 100));
+  }
+}
+
+// runs on the audio task for every decoded frame, just before it goes to I2S
+void audio_process_i2s(uint32_t *sample, bool *continueI2S)
+{
+  audioDsp.process((int16_t *)sample, 1);
+  *continueI2S = true;
+}
+
 void audio_info(const char *info)
 {
   Serial.print("info        ");
@@ -163,13 +590,10 @@ void audio_id3data(const char *info)
   Serial.print("id3data     ");
   Serial.println(info);
 
-  std::string data;
-  data.append(info);
-  if (data.rfind("Title") == 0)
+  // indexed tracks published their title when they started
+  if (currentMetadata.title[0] == '\0' && strncmp(info, "Title: ", 7) == 0)
   {
-    std::string title = data.substr(7);
-    publishState(audioSource->isRunning, volume, title.c_str());
-    delay(500);
+    requestStatePublish(info + 7);
   }
 }
 void audio_eof_stream(const char *lastHost)
@@ -186,6 +610,7 @@ void audio_eof_mp3(const char *info)
 { // end of file
   Serial.print("eof_mp3     ");
   Serial.println(info);
+  storeMeasuredGain();
   if (audioSource->isRunning)
   {
     playRandomSong();
@@ -1,7 +1,14 @@
 #include "AudioSource.h"
 #include "SoapESP32.h"
+#include "Config.h"
 
-#define DLNA_PREFIX "http://192.168.0.181:8200/"
+// id of the container whose sub-containers are offered as genres, "0" is the server root
+#ifndef DLNA_GENRE_CONTAINER_ID
+#define DLNA_GENRE_CONTAINER_ID "0"
+#endif
+
+#define DLNA_SERVER_IDX 0
+#define DLNA_BROWSE_PAGE_SIZE 100
 
 WiFiClient client;
 WiFiUDP udp;
@@ -9,19 +16,71 @@ SoapESP32 soap(&client, &udp);
 
 void discoverDlnaServer();
 void fetchPlaylist(String objectId, std::list<String> *playlist);
+String toStreamUri(soapObject_t &object);
 
 void DLNAAudioSource::populateAudioMenu(AudioMenu &menu)
 {
-  std::list<String> playlist;
+  menu.audioMap.clear();
+  _genreContainerIds.clear();
   discoverDlnaServer();
-  fetchPlaylist("0", &playlist);
-  menu.audioMap[""] = playlist;
+
+  // only the genre containers are listed here, tracks are fetched once a genre is selected
+  soapObjectVect_t browseResult;
+  soap.browseServer(DLNA_SERVER_IDX, DLNA_GENRE_CONTAINER_ID, &browseResult);
+  for (int i = 0; i < browseResult.size(); i++)
+  {
+    soapObject_t object = browseResult[i];
+    if (object.isDirectory)
+    {
+      menu.audioMap[object.name] = list<String>();
+      _genreContainerIds[object.name] = object.id;
+    }
+  }
+
+  if (_genreContainerIds.size() == 0)
+  {
+    // no sub-containers, so the whole container is played as a single genre
+    menu.audioMap[""] = list<String>();
+    _genreContainerIds[""] = DLNA_GENRE_CONTAINER_ID;
+  }
+
+  String genre = spConfig.defaultAudioGenre;
+  if (_genreContainerIds.find(genre) == _genreContainerIds.end())
+  {
+    genre = _genreContainerIds.begin()->first;
+  }
+  selectGenre(menu, genre);
+}
+
+void DLNAAudioSource::selectGenre(AudioMenu &menu, String genre)
+{
+  auto containerIt = _genreContainerIds.find(genre);
+  if (containerIt == _genreContainerIds.end())
+  {
+    Serial.printf("Genre %s is not available on the DLNA server.\n", genre.c_str());
+    return;
+  }
+
+  menu.selectedGenre = genre;
+  if (menu.audioMap[genre].size() > 0)
+  {
+    return;
+  }
+
+  // keep only the playing genre in memory
+  for (auto it = menu.audioMap.begin(); it != menu.audioMap.end(); it++)
+  {
+    it->second.clear();
+  }
+
+  unsigned long tStart = millis();
+  fetchPlaylist(containerIt->second, &menu.audioMap[genre]);
+  Serial.printf("Loaded %d songs in genre %s from DLNA in %lu ms.\n", menu.audioMap[genre].size(), genre.c_str(), millis() - tStart);
 }
 
-void DLNAAudioSource::play(String path, Audio *audio)
+void DLNAAudioSource::play(String uri, Audio *audio)
 {
   this->isRunning = true;
-  String uri = DLNA_PREFIX + path;
   audio->connecttohost(uri.c_str());
 }
 
@@ -47,33 +106,56 @@ void discoverDlnaServer()
   }
 
   soapServer_t srv;
-  soap.getServerInfo(0, &srv);
+  soap.getServerInfo(DLNA_SERVER_IDX, &srv);
   Serial.printf("Server[%d]: IP address: %s port: %d name: %s -> controlURL: %s\n",
-                0, srv.ip.toString().c_str(), srv.port, srv.friendlyName.c_str(), srv.controlURL.c_str());
+                DLNA_SERVER_IDX, srv.ip.toString().c_str(), srv.port, srv.friendlyName.c_str(), srv.controlURL.c_str());
 }
 
 void fetchPlaylist(String objectId, std::list<String> *playlist)
 {
   std::vector<String> dirIds{};
   soapObjectVect_t browseResult;
+  uint32_t startingIndex = 0;
 
-  soap.browseServer(0, objectId.c_str(), &browseResult);
-
-  for (int i = 0; i < browseResult.size(); i++)
+  // large containers are returned by the server in pages
+  do
   {
-    soapObject_t object = browseResult[i];
-    if (object.isDirectory)
+    browseResult.clear();
+    if (!soap.browseServer(DLNA_SERVER_IDX, objectId.c_str(), &browseResult, startingIndex, DLNA_BROWSE_PAGE_SIZE))
     {
-      dirIds.push_back(object.id);
+      Serial.printf("Unable to browse DLNA container %s.\n", objectId.c_str());
+      break;
     }
-    else
+
+    for (int i = 0; i < browseResult.size(); i++)
     {
-      playlist->push_back(object.uri);
+      soapObject_t object = browseResult[i];
+      if (object.isDirectory)
+      {
+        dirIds.push_back(object.id);
+      }
+      else
+      {
+        playlist->push_back(toStreamUri(object));
+      }
     }
-  }
+    startingIndex += browseResult.size();
+  } while (browseResult.size() == DLNA_BROWSE_PAGE_SIZE);
 
   for (int j = 0; j < dirIds.size(); j++)
   {
     fetchPlaylist(dirIds[j], playlist);
   }
-}
\ No newline at end of file
+}
+
+// items carry the address of the server that streams them, which is not
+// necessarily the one that answered the browse request
+String toStreamUri(soapObject_t &object)
+{
+  String uri = "http://" + object.downloadIp.toString() + ":" + String(object.downloadPort);
+  if (!object.uri.startsWith("/"))
+  {
+    uri += "/";
+  }
+  return uri + object.uri;
+}
@@ -0,0 +1,365 @@
+#include "AudioSource.h"
+#include "Config.h"
+#include "lwip/sockets.h"
+
+#ifndef HTTP_AUDIO_PROXY_PORT
+#define HTTP_AUDIO_PROXY_PORT 8081
+#endif
+
+// read-ahead capacity in PSRAM, and in internal RAM on boards without PSRAM
+#define HTTP_AUDIO_BUFFER_SIZE 262144
+#define HTTP_AUDIO_FALLBACK_BUFFER_SIZE 32768
+
+// the buffer target covers the base time plus a multiple of the worst recent stall
+#define HTTP_AUDIO_BASE_BUFFER_MS 1000
+#define HTTP_AUDIO_JITTER_FACTOR 2
+#define HTTP_AUDIO_MIN_TARGET 8192
+#define HTTP_AUDIO_DEFAULT_BYTE_RATE 16000 // 128 kbps until playback is measured
+
+#define HTTP_AUDIO_SERVE_CHUNK 2048
+#define HTTP_AUDIO_MAX_RECONNECT_DELAY_MS 4000
+
+void runHttpAudioSource(void *);
+
+HttpAudioSource::HttpAudioSource(std::map<String, list<String>> urls)
+{
+  _urls = urls;
+  if (!_ring.init(HTTP_AUDIO_BUFFER_SIZE, HTTP_AUDIO_FALLBACK_BUFFER_SIZE))
+  {
+    Serial.println("Unable to allocate the HTTP audio buffer!");
+    return;
+  }
+  Serial.printf("HTTP audio buffer of %d bytes allocated.\n", _ring.capacity());
+
+  _byteRate = HTTP_AUDIO_DEFAULT_BYTE_RATE;
+  updateTarget();
+
+  _proxyServer = new WiFiServer(HTTP_AUDIO_PROXY_PORT);
+  _proxyServer->begin();
+
+  // network side of the player, kept off the decoder's core
+  xTaskCreatePinnedToCore(
+      runHttpAudioSource,
+      "HTTP audio",
+      6144,
+      this,
+      5,
+      NULL,
+      0);
+}
+
+void HttpAudioSource::populateAudioMenu(AudioMenu &menu)
+{
+  menu.audioMap = _urls;
+  menu.selectedGenre = spConfig.defaultAudioGenre;
+}
+
+void HttpAudioSource::play(String url, Audio *audio)
+{
+  if (url.length() >= HTTP_AUDIO_URL_MAX_LEN)
+  {
+    Serial.printf("Url %s is longer than %d characters, ignored.\n", url.c_str(), HTTP_AUDIO_URL_MAX_LEN - 1);
+    return;
+  }
+
+  this->isRunning = true;
+  // a plain copy, nothing in a critical section may allocate
+  portENTER_CRITICAL(&_urlMux);
+  memcpy(_url, url.c_str(), url.length() + 1);
+  portEXIT_CRITICAL(&_urlMux);
+  _generation++;
+
+  Serial.printf("Now streaming %s through the read-ahead buffer.\n", url.c_str());
+  String proxyUri = "http://127.0.0.1:" + String(HTTP_AUDIO_PROXY_PORT) + "/stream";
+  audio->connecttohost(proxyUri.c_str());
+}
+
+void HttpAudioSource::pause()
+{
+  this->isRunning = false;
+}
+
+void HttpAudioSource::resume()
+{
+  this->isRunning = true;
+}
+
+uint32_t HttpAudioSource::getUnderrunCount()
+{
+  return _underruns;
+}
+
+void runHttpAudioSource(void *parameter)
+{
+  HttpAudioSource *source = (HttpAudioSource *)parameter;
+  for (;;)
+  {
+    source->run();
+  }
+}
+
+void HttpAudioSource::run()
+{
+  if (_servedGeneration != _generation)
+  {
+    restart();
+  }
+
+  fillFromUpstream();
+  serveLocalClient();
+
+  // yield a little longer while there is nothing to move
+  vTaskDelay(_upstream == nullptr && !_local.connected() ? pdMS_TO_TICKS(20) : 1);
+}
+
+// drops the current stream and starts over with the latest requested url
+void HttpAudioSource::restart()
+{
+  _servedGeneration = _generation;
+  disconnectUpstream();
+  _local.stop();
+  _ring.clear();
+
+  _contentType = "";
+  _contentLength = -1;
+  _acceptRanges = false;
+  _offset = 0;
+  _skip = 0;
+  _upstreamDone = false;
+  _reconnectAttempts = 0;
+  _headerSent = false;
+  _buffering = true;
+
+  connectUpstream();
+}
+
+void HttpAudioSource::connectUpstream()
+{
+  char url[HTTP_AUDIO_URL_MAX_LEN];
+  portENTER_CRITICAL(&_urlMux);
+  memcpy(url, _url, sizeof(url));
+  portEXIT_CRITICAL(&_urlMux);
+  if (url[0] == '\0')
+  {
+    return;
+  }
+
+  const char *headerKeys[] = {"Content-Type", "Accept-Ranges"};
+  _http.begin(url);
+  _http.useHTTP10(true); // keeps the body free of chunked transfer encoding
+  _http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+  _http.collectHeaders(headerKeys, 2);
+
+  bool resuming = _offset > 0 && _acceptRanges;
+  if (resuming)
+  {
+    _http.addHeader("Range", "bytes=" + String(_offset) + "-");
+  }
+
+  int code = _http.GET();
+  if (code != HTTP_CODE_OK && code != HTTP_CODE_PARTIAL_CONTENT)
+  {
+    Serial.printf("Unable to connect to %s, http code: %d\n", url, code);
+    disconnectUpstream();
+    return;
+  }
+
+  if (_offset == 0)
+  {
+    _contentType = _http.header("Content-Type");
+    _contentLength = _http.getSize();
+    _acceptRanges = _contentLength > 0 && _http.header("Accept-Ranges") == "bytes";
+  }
+  else if (code == HTTP_CODE_OK && _contentLength > 0)
+  {
+    // the server ignored the range, so skip what was already buffered
+    _skip = _offset;
+    _offset = 0;
+  }
+
+  _upstream = _http.getStreamPtr();
+  _reconnectAttempts = 0;
+  if (_offset == 0)
+  {
+    // after a dropout the outage itself counts as a gap between arrivals
+    _lastArrivalMs = millis();
+  }
+  Serial.printf("Connected to %s at offset %d.\n", url, resuming ? _offset : 0);
+}
+
+void HttpAudioSource::disconnectUpstream()
+{
+  _upstream = nullptr;
+  _http.end();
+
+  // back off exponentially while the network is down
+  uint32_t delayMs = min(250UL << min(_reconnectAttempts, (uint8_t)4), (unsigned long)HTTP_AUDIO_MAX_RECONNECT_DELAY_MS);
+  _reconnectAtMs = millis() + delayMs;
+  _reconnectAttempts++;
+}
+
+void HttpAudioSource::fillFromUpstream()
+{
+  if (_upstreamDone)
+  {
+    return;
+  }
+
+  if (_upstream == nullptr)
+  {
+    if (_servedGeneration > 0 && (long)(millis() - _reconnectAtMs) >= 0)
+    {
+      connectUpstream();
+    }
+    return;
+  }
+
+  if (_upstream->available() == 0)
+  {
+    if (!_upstream->connected())
+    {
+      if (_contentLength > 0 && _offset >= (size_t)_contentLength)
+      {
+        _upstreamDone = true;
+        _http.end();
+        _upstream = nullptr;
+        return;
+      }
+
+      Serial.printf("Upstream dropped at offset %d, reconnecting.\n", _offset);
+      disconnectUpstream();
+    }
+    return;
+  }
+
+  // the worst gap between arrivals decays slowly so one stall keeps the buffer larger for a while
+  unsigned long now = millis();
+  uint32_t gap = now - _lastArrivalMs;
+  _lastArrivalMs = now;
+  _jitterMs = max(gap, _jitterMs - (_jitterMs >> 6));
+
+  uint8_t *ptr;
+  size_t len = _ring.writeRegion(&ptr);
+  if (len == 0)
+  {
+    return;
+  }
+
+  int n = _upstream->read(ptr, len);
+  if (n <= 0)
+  {
+    return;
+  }
+
+  _offset += n;
+  if (_skip > 0)
+  {
+    size_t skipped = min((size_t)n, _skip);
+    _skip -= skipped;
+    if (skipped == (size_t)n)
+    {
+      return;
+    }
+    memmove(ptr, ptr + skipped, n - skipped);
+    n -= skipped;
+  }
+  _ring.commitWrite(n);
+}
+
+void HttpAudioSource::serveLocalClient()
+{
+  if (!_local.connected())
+  {
+    if (_servedGeneration != _generation)
+    {
+      // the connection waiting in the backlog belongs to the stream about to start
+      return;
+    }
+
+    WiFiClient client = _proxyServer->available();
+    if (!client)
+    {
+      return;
+    }
+    _local = client;
+    _headerSent = false;
+    _buffering = true;
+  }
+
+  // the decoder's request is always for the current stream, so its headers are not needed
+  while (_local.available())
+  {
+    _local.read();
+  }
+
+  if (!_headerSent)
+  {
+    if (_contentType == "")
+    {
+      // the upstream headers are not known yet
+      return;
+    }
+
+    String header = "HTTP/1.1 200 OK\r\nContent-Type: " + _contentType + "\r\nConnection: close\r\n";
+    if (_contentLength > 0)
+    {
+      header += "Content-Length: " + String(_contentLength) + "\r\n";
+    }
+    header += "\r\n";
+    _local.write((const uint8_t *)header.c_str(), header.length());
+    _headerSent = true;
+  }
+
+  if (_buffering)
+  {
+    if (_ring.available() < _target && !_upstreamDone)
+    {
+      return;
+    }
+    _buffering = false;
+  }
+
+  uint8_t *ptr;
+  size_t len = _ring.readRegion(&ptr);
+  if (len == 0)
+  {
+    if (_upstreamDone)
+    {
+      _local.stop();
+      return;
+    }
+
+    // the decoder drained everything we had, refill up to the target before serving again
+    _underruns++;
+    _buffering = true;
+    Serial.printf("HTTP audio underrun #%d, buffering %d bytes.\n", (uint32_t)_underruns, _target);
+    return;
+  }
+
+  // non-blocking so a paused decoder does not stall the upstream side
+  int sent = send(_local.fd(), ptr, min(len, (size_t)HTTP_AUDIO_SERVE_CHUNK), MSG_DONTWAIT);
+  if (sent > 0)
+  {
+    _ring.commitRead(sent);
+    _servedInWindow += sent;
+  }
+
+  unsigned long now = millis();
+  if (now - _rateWindowStartMs >= 1000)
+  {
+    if (!_buffering && _servedInWindow > 0)
+    {
+      _byteRate = (_byteRate * 3 + _servedInWindow * 1000 / (now - _rateWindowStartMs)) / 4;
+    }
+    _servedInWindow = 0;
+    _rateWindowStartMs = now;
+    updateTarget();
+  }
+}
+
+void HttpAudioSource::updateTarget()
+{
+  uint32_t bufferMs = HTTP_AUDIO_BASE_BUFFER_MS + HTTP_AUDIO_JITTER_FACTOR * _jitterMs;
+  size_t target = (size_t)((uint64_t)_byteRate * bufferMs / 1000);
+  _target = constrain(target, (size_t)HTTP_AUDIO_MIN_TARGET, _ring.capacity() / 2);
+}
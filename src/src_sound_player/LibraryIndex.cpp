@@ -0,0 +1,222 @@
+#include "LibraryIndex.h"
+#include "Fnv1a.h"
+#include <algorithm>
+
+#define LIBRARY_METADATA_LOAD_CHUNK 8 // records read at once while loading
+
+bool compareGain(const TrackGain &a, const TrackGain &b)
+{
+  return a.pathHash < b.pathHash;
+}
+
+bool compareRecord(const TrackRecord &a, const TrackRecord &b)
+{
+  return a.pathHash < b.pathHash;
+}
+
+void LibraryIndex::load(fs::FS &fs)
+{
+  _fs = &fs;
+  _gains.clear();
+
+  loadMetadata();
+
+  File file = fs.open(LIBRARY_GAIN_INDEX_PATH, FILE_READ);
+  if (!file)
+  {
+    Serial.println("No track gain index found, gains will be measured during playback.");
+    return;
+  }
+
+  _gains.resize(file.size() / sizeof(TrackGain));
+  file.read((uint8_t *)_gains.data(), _gains.size() * sizeof(TrackGain));
+  file.close();
+
+  // records are appended as tracks finish, later records override earlier ones
+  std::stable_sort(_gains.begin(), _gains.end(), compareGain);
+  auto last = std::unique(_gains.rbegin(), _gains.rend(), [](const TrackGain &a, const TrackGain &b)
+                          { return a.pathHash == b.pathHash; });
+  _gains.erase(_gains.begin(), last.base());
+  Serial.printf("Loaded gains of %d tracks.\n", _gains.size());
+}
+
+bool LibraryIndex::findGain(const String &path, int16_t &gainCentiDb)
+{
+  TrackGain key{fnv1a(path.c_str()), 0};
+  auto it = std::lower_bound(_gains.begin(), _gains.end(), key, compareGain);
+  if (it == _gains.end() || it->pathHash != key.pathHash)
+  {
+    return false;
+  }
+  gainCentiDb = it->gainCentiDb;
+  return true;
+}
+
+void LibraryIndex::storeGain(const String &path, int16_t gainCentiDb)
+{
+  TrackGain record{fnv1a(path.c_str()), gainCentiDb};
+  auto it = std::lower_bound(_gains.begin(), _gains.end(), record, compareGain);
+  if (it != _gains.end() && it->pathHash == record.pathHash)
+  {
+    if (it->gainCentiDb == gainCentiDb)
+    {
+      return;
+    }
+    it->gainCentiDb = gainCentiDb;
+  }
+  else
+  {
+    _gains.insert(it, record);
+  }
+
+  if (_fs == nullptr)
+  {
+    return;
+  }
+
+  _fs->mkdir(LIBRARY_INDEX_DIR);
+  File file = _fs->open(LIBRARY_GAIN_INDEX_PATH, FILE_APPEND);
+  if (!file)
+  {
+    Serial.println("Unable to update the track gain index.");
+    return;
+  }
+  file.write((const uint8_t *)&record, sizeof(TrackGain));
+  file.close();
+}
+
+// only the path hashes stay in memory, the records are read when a track starts
+void LibraryIndex::loadMetadata()
+{
+  _records.clear();
+  _recordCount = 0;
+
+  File file = _fs->open(LIBRARY_METADATA_INDEX_PATH, FILE_READ);
+  if (!file)
+  {
+    return;
+  }
+
+  // appends are positional, so a record cut short by a power loss would shift
+  // every one after it
+  if (file.size() % sizeof(TrackMetadata) != 0)
+  {
+    file.close();
+    _fs->remove(LIBRARY_METADATA_INDEX_PATH);
+    Serial.println("Track metadata index damaged, rebuilding it.");
+    return;
+  }
+
+  TrackMetadata chunk[LIBRARY_METADATA_LOAD_CHUNK];
+  _records.reserve(file.size() / sizeof(TrackMetadata));
+  size_t read;
+  while ((read = file.read((uint8_t *)chunk, sizeof(chunk)) / sizeof(TrackMetadata)) > 0)
+  {
+    for (size_t i = 0; i < read; i++)
+    {
+      _records.push_back({chunk[i].pathHash, _recordCount++});
+    }
+  }
+  file.close();
+
+  // later records override earlier ones, as for the gains
+  std::stable_sort(_records.begin(), _records.end(), compareRecord);
+  auto last = std::unique(_records.rbegin(), _records.rend(), [](const TrackRecord &a, const TrackRecord &b)
+                          { return a.pathHash == b.pathHash; });
+  _records.erase(_records.begin(), last.base());
+  Serial.printf("Loaded metadata of %d tracks.\n", _records.size());
+}
+
+// the file name without its extension
+void titleFromPath(const String &path, char *title)
+{
+  int start = path.lastIndexOf('/') + 1;
+  int end = path.lastIndexOf('.');
+  if (end <= start)
+  {
+    end = path.length();
+  }
+  strlcpy(title, path.c_str() + start, min(end - start + 1, TRACK_TITLE_MAX_LEN));
+}
+
+size_t LibraryIndex::indexMetadata(const std::list<String> &paths)
+{
+  if (_fs == nullptr)
+  {
+    return 0;
+  }
+
+  File index;
+  size_t indexed = 0;
+  for (const String &path : paths)
+  {
+    TrackRecord record{fnv1a(path.c_str()), _recordCount};
+    auto it = std::lower_bound(_records.begin(), _records.end(), record, compareRecord);
+    if (it != _records.end() && it->pathHash == record.pathHash)
+    {
+      continue;
+    }
+
+    File track = _fs->open(path, FILE_READ);
+    if (!track)
+    {
+      continue;
+    }
+
+    // files without tags get a record too, so they are not read again
+    TrackMetadata meta;
+    readTrackMetadata(track, meta);
+    track.close();
+    meta.pathHash = record.pathHash;
+    if (meta.title[0] == '\0')
+    {
+      titleFromPath(path, meta.title);
+    }
+
+    if (!index)
+    {
+      _fs->mkdir(LIBRARY_INDEX_DIR);
+      index = _fs->open(LIBRARY_METADATA_INDEX_PATH, FILE_APPEND);
+      if (!index)
+      {
+        Serial.println("Unable to update the track metadata index.");
+        return indexed;
+      }
+    }
+    if (index.write((const uint8_t *)&meta, sizeof(TrackMetadata)) != sizeof(TrackMetadata))
+    {
+      break;
+    }
+
+    _records.insert(it, record);
+    _recordCount++;
+    indexed++;
+  }
+
+  if (index)
+  {
+    index.close();
+  }
+  return indexed;
+}
+
+bool LibraryIndex::findMetadata(const String &path, TrackMetadata &meta)
+{
+  TrackRecord key{fnv1a(path.c_str()), 0};
+  auto it = std::lower_bound(_records.begin(), _records.end(), key, compareRecord);
+  if (_fs == nullptr || it == _records.end() || it->pathHash != key.pathHash)
+  {
+    return false;
+  }
+
+  File file = _fs->open(LIBRARY_METADATA_INDEX_PATH, FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+  bool found = file.seek(it->index * sizeof(TrackMetadata)) &&
+               file.read((uint8_t *)&meta, sizeof(TrackMetadata)) == sizeof(TrackMetadata) &&
+               meta.pathHash == key.pathHash;
+  file.close();
+  return found;
+}
@@ -74,6 +74,11 @@ void SDAudioSource::play(String path, Audio *audio)
   audio->connecttoFS(SD, path.c_str());
 }
 
+fs::FS *SDAudioSource::getLibraryFS()
+{
+  return &SD;
+}
+
 void SDAudioSource::pause()
 {
   this->isRunning = false;
@@ -0,0 +1,510 @@
+#include "TrackMetadata.h"
+
+#define METADATA_BUFFER_LEN 1024 // a FLAC comment block or Ogg page is only read this far
+#define METADATA_FIELD_MAX_LEN 160
+#define METADATA_OGG_TAIL_LEN 16384 // how far from the end the last Ogg page is looked for
+
+// only used while indexing, which happens on the audio task before playback
+uint8_t metadataBuffer[METADATA_BUFFER_LEN];
+
+const uint16_t mpeg1Bitrates[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+const uint16_t mpeg2Bitrates[] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+const uint16_t mpeg1SampleRates[] = {44100, 48000, 32000};
+
+uint32_t readBE32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+uint32_t readLE32(const uint8_t *p)
+{
+  return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+// ID3v2 sizes keep the top bit of every byte clear
+uint32_t readSyncsafe(const uint8_t *p)
+{
+  return (uint32_t)(p[0] & 0x7F) << 21 | (uint32_t)(p[1] & 0x7F) << 14 | (uint32_t)(p[2] & 0x7F) << 7 | (p[3] & 0x7F);
+}
+
+// copies UTF-8 text, cut at a character boundary when it does not fit
+void copyUtf8(char *out, size_t outMax, const char *text, size_t len)
+{
+  len = strnlen(text, len);
+  size_t n = min(len, outMax - 1);
+  if (n < len)
+  {
+    while (n > 0 && ((uint8_t)text[n] & 0xC0) == 0x80)
+    {
+      n--;
+    }
+  }
+  memcpy(out, text, n);
+  out[n] = '\0';
+}
+
+// appends a character as UTF-8, only if it fits completely
+bool appendUtf8(char *out, size_t outMax, size_t &len, uint16_t c)
+{
+  size_t bytes = c < 0x80 ? 1 : (c < 0x800 ? 2 : 3);
+  if (len + bytes >= outMax)
+  {
+    return false;
+  }
+
+  if (bytes == 1)
+  {
+    out[len++] = c;
+  }
+  else if (bytes == 2)
+  {
+    out[len++] = 0xC0 | c >> 6;
+    out[len++] = 0x80 | (c & 0x3F);
+  }
+  else
+  {
+    out[len++] = 0xE0 | c >> 12;
+    out[len++] = 0x80 | (c >> 6 & 0x3F);
+    out[len++] = 0x80 | (c & 0x3F);
+  }
+  return true;
+}
+
+// converts one terminated string of an ID3v2 frame to UTF-8 and returns how
+// many bytes of the frame it took, terminator included
+size_t decodeId3Text(uint8_t encoding, const uint8_t *data, size_t len, char *out, size_t outMax)
+{
+  if (encoding == 3)
+  {
+    size_t n = strnlen((const char *)data, len);
+    copyUtf8(out, outMax, (const char *)data, n);
+    return min(n + 1, len);
+  }
+
+  // 0 is ISO-8859-1, 1 UTF-16 with a byte order mark, 2 UTF-16BE
+  bool utf16 = encoding == 1 || encoding == 2;
+  bool bigEndian = encoding == 2;
+  size_t i = 0;
+  if (encoding == 1 && len >= 2 && ((data[0] == 0xFE && data[1] == 0xFF) || (data[0] == 0xFF && data[1] == 0xFE)))
+  {
+    bigEndian = data[0] == 0xFE;
+    i = 2;
+  }
+
+  size_t o = 0;
+  bool full = false;
+  while (i < len)
+  {
+    uint16_t c;
+    if (utf16)
+    {
+      if (i + 1 >= len)
+      {
+        i = len;
+        break;
+      }
+      c = bigEndian ? data[i] << 8 | data[i + 1] : data[i] | data[i + 1] << 8;
+      i += 2;
+    }
+    else
+    {
+      c = data[i++];
+    }
+
+    if (c == 0)
+    {
+      break;
+    }
+    if (c >= 0xD800 && c < 0xE000)
+    {
+      // characters outside the basic plane show up as one replacement
+      if (c >= 0xDC00)
+      {
+        continue;
+      }
+      c = '?';
+    }
+    if (!full)
+    {
+      full = !appendUtf8(out, outMax, o, c);
+    }
+  }
+  out[o] = '\0';
+  return i;
+}
+
+// ReplayGain values are written as "-6.54 dB"
+bool parseReplayGain(const char *text, int16_t &gainCentiDb)
+{
+  char *end;
+  float gainDb = strtof(text, &end);
+  if (end == text || gainDb < -100 || gainDb > 100)
+  {
+    return false;
+  }
+  gainCentiDb = (int16_t)lroundf(gainDb * 100);
+  return true;
+}
+
+void readVorbisComment(const char *comment, size_t len, TrackMetadata &meta)
+{
+  const char *separator = (const char *)memchr(comment, '=', len);
+  if (separator == nullptr)
+  {
+    return;
+  }
+
+  size_t keyLen = separator - comment;
+  const char *value = separator + 1;
+  size_t valueLen = len - keyLen - 1;
+  char text[16];
+
+  if (keyLen == 5 && strncasecmp(comment, "TITLE", keyLen) == 0)
+  {
+    copyUtf8(meta.title, TRACK_TITLE_MAX_LEN, value, valueLen);
+  }
+  else if (keyLen == 6 && strncasecmp(comment, "ARTIST", keyLen) == 0)
+  {
+    copyUtf8(meta.artist, TRACK_ARTIST_MAX_LEN, value, valueLen);
+  }
+  else if (keyLen == 5 && strncasecmp(comment, "ALBUM", keyLen) == 0)
+  {
+    copyUtf8(meta.album, TRACK_ALBUM_MAX_LEN, value, valueLen);
+  }
+  else if (keyLen == 21 && strncasecmp(comment, "REPLAYGAIN_TRACK_GAIN", keyLen) == 0)
+  {
+    copyUtf8(text, sizeof(text), value, valueLen);
+    parseReplayGain(text, meta.replayGainCentiDb);
+  }
+  else if (keyLen == 15 && strncasecmp(comment, "R128_TRACK_GAIN", keyLen) == 0 && meta.replayGainCentiDb == TRACK_NO_REPLAY_GAIN)
+  {
+    // Opus gains are Q7.8 dB towards -23 LUFS, 5 dB below the ReplayGain reference
+    copyUtf8(text, sizeof(text), value, valueLen);
+    char *end;
+    long q78 = strtol(text, &end, 10);
+    if (end != text)
+    {
+      meta.replayGainCentiDb = (int16_t)(q78 * 100 / 256 + 500);
+    }
+  }
+}
+
+// a Vorbis comment block: vendor string, then count times length and KEY=value,
+// all little endian; comments past the end of the data read are skipped
+void readVorbisComments(const uint8_t *data, size_t len, TrackMetadata &meta)
+{
+  if (len < 8 || readLE32(data) > len - 8)
+  {
+    return;
+  }
+  size_t pos = 4 + readLE32(data);
+  uint32_t count = readLE32(data + pos);
+  pos += 4;
+
+  for (uint32_t i = 0; i < count && pos + 4 <= len; i++)
+  {
+    size_t commentLen = min((size_t)readLE32(data + pos), len - pos - 4);
+    pos += 4;
+    readVorbisComment((const char *)data + pos, commentLen, meta);
+    pos += commentLen;
+  }
+}
+
+void readId3Frame(const char *id, const uint8_t *data, size_t len, TrackMetadata &meta, uint32_t &lengthMs)
+{
+  if (len < 2)
+  {
+    return;
+  }
+
+  char text[METADATA_FIELD_MAX_LEN];
+  if (memcmp(id, "TIT2", 4) == 0)
+  {
+    decodeId3Text(data[0], data + 1, len - 1, meta.title, TRACK_TITLE_MAX_LEN);
+  }
+  else if (memcmp(id, "TPE1", 4) == 0)
+  {
+    decodeId3Text(data[0], data + 1, len - 1, meta.artist, TRACK_ARTIST_MAX_LEN);
+  }
+  else if (memcmp(id, "TALB", 4) == 0)
+  {
+    decodeId3Text(data[0], data + 1, len - 1, meta.album, TRACK_ALBUM_MAX_LEN);
+  }
+  else if (memcmp(id, "TLEN", 4) == 0)
+  {
+    decodeId3Text(data[0], data + 1, len - 1, text, sizeof(text));
+    lengthMs = strtoul(text, nullptr, 10);
+  }
+  else if (memcmp(id, "TXXX", 4) == 0)
+  {
+    // a description and a value, both in the encoding of the frame
+    size_t taken = decodeId3Text(data[0], data + 1, len - 1, text, sizeof(text));
+    if (strcasecmp(text, "REPLAYGAIN_TRACK_GAIN") == 0)
+    {
+      decodeId3Text(data[0], data + 1 + taken, len - 1 - taken, text, sizeof(text));
+      parseReplayGain(text, meta.replayGainCentiDb);
+    }
+  }
+}
+
+// ID3v2.3 and 2.4 frames; compressed, encrypted and unsynchronised ones are
+// skipped, those never hold the plain text frames that are of interest here
+void readId3Frames(fs::File &file, const uint8_t *header, TrackMetadata &meta, uint32_t &lengthMs)
+{
+  uint8_t version = header[3];
+  uint8_t flags = header[5];
+  uint32_t end = 10 + readSyncsafe(header + 6);
+  uint32_t pos = 10;
+  uint8_t frameHeader[10];
+
+  if (flags & 0x40)
+  {
+    file.seek(pos);
+    file.read(frameHeader, 4);
+    pos += version == 4 ? readSyncsafe(frameHeader) : readBE32(frameHeader) + 4;
+  }
+
+  while (pos + 10 <= end)
+  {
+    file.seek(pos);
+    if (file.read(frameHeader, 10) != 10 || frameHeader[0] == 0)
+    {
+      // padding
+      break;
+    }
+
+    uint32_t size = version == 4 ? readSyncsafe(frameHeader + 4) : readBE32(frameHeader + 4);
+    uint8_t formatFlags = frameHeader[9];
+    bool skipped = version == 4 ? formatFlags & 0x0E : formatFlags & 0xC0;
+    bool wanted = frameHeader[0] == 'T' && (memcmp(frameHeader, "TIT2", 4) == 0 || memcmp(frameHeader, "TPE1", 4) == 0 ||
+                                            memcmp(frameHeader, "TALB", 4) == 0 || memcmp(frameHeader, "TLEN", 4) == 0 ||
+                                            memcmp(frameHeader, "TXXX", 4) == 0);
+    if (wanted && !skipped && size <= end - pos - 10)
+    {
+      size_t len = file.read(metadataBuffer, min(size, (uint32_t)METADATA_FIELD_MAX_LEN));
+      size_t offset = version == 4 && (formatFlags & 0x01) ? 4 : 0; // data length indicator
+      if (len > offset)
+      {
+        readId3Frame((const char *)frameHeader, metadataBuffer + offset, len - offset, meta, lengthMs);
+      }
+    }
+    pos += 10 + size;
+  }
+}
+
+// the duration of an mp3 from its first Layer III frame: the frame count of a
+// Xing or Info header when there is one, otherwise the size at constant bitrate
+uint32_t readMpegDurationSec(fs::File &file, uint32_t audioStart)
+{
+  file.seek(audioStart);
+  size_t len = file.read(metadataBuffer, METADATA_BUFFER_LEN);
+
+  for (size_t i = 0; i + 4 <= len; i++)
+  {
+    const uint8_t *frame = metadataBuffer + i;
+    if (frame[0] != 0xFF || (frame[1] & 0xE0) != 0xE0)
+    {
+      continue;
+    }
+
+    uint8_t version = frame[1] >> 3 & 0x03; // 3 is MPEG 1, 2 MPEG 2, 0 MPEG 2.5
+    uint8_t layer = frame[1] >> 1 & 0x03;   // 1 is Layer III
+    uint8_t bitrateIndex = frame[2] >> 4;
+    uint8_t sampleRateIndex = frame[2] >> 2 & 0x03;
+    if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3)
+    {
+      continue;
+    }
+
+    bool mpeg1 = version == 3;
+    bool mono = frame[3] >> 6 == 3;
+    // MPEG 2 halves the rates of MPEG 1, MPEG 2.5 halves them again
+    uint32_t sampleRate = mpeg1SampleRates[sampleRateIndex] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    uint32_t samplesPerFrame = mpeg1 ? 1152 : 576;
+    uint32_t bitrate = (mpeg1 ? mpeg1Bitrates : mpeg2Bitrates)[bitrateIndex] * 1000;
+
+    size_t xing = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+    if (xing + 12 <= len && (memcmp(metadataBuffer + xing, "Xing", 4) == 0 || memcmp(metadataBuffer + xing, "Info", 4) == 0) &&
+        (readBE32(metadataBuffer + xing + 4) & 0x01))
+    {
+      return (uint64_t)readBE32(metadataBuffer + xing + 8) * samplesPerFrame / sampleRate;
+    }
+    return (uint64_t)(file.size() - audioStart - i) * 8 / bitrate;
+  }
+  return TRACK_NO_DURATION;
+}
+
+bool readMp3(fs::File &file, TrackMetadata &meta)
+{
+  uint8_t header[10];
+  file.seek(0);
+  if (file.read(header, 10) != 10)
+  {
+    return false;
+  }
+
+  uint32_t audioStart = 0;
+  uint32_t lengthMs = 0;
+  if (memcmp(header, "ID3", 3) == 0)
+  {
+    audioStart = 10 + readSyncsafe(header + 6) + (header[5] & 0x10 ? 10 : 0);
+    if (header[3] == 3 || header[3] == 4)
+    {
+      readId3Frames(file, header, meta, lengthMs);
+    }
+  }
+
+  uint32_t durationSec = lengthMs > 0 ? lengthMs / 1000 : readMpegDurationSec(file, audioStart);
+  meta.durationSec = min(durationSec, (uint32_t)UINT16_MAX);
+  return audioStart > 0 || durationSec != TRACK_NO_DURATION;
+}
+
+bool readFlac(fs::File &file, TrackMetadata &meta)
+{
+  uint32_t pos = 4;
+  uint8_t blockHeader[4];
+
+  do
+  {
+    file.seek(pos);
+    if (file.read(blockHeader, 4) != 4)
+    {
+      break;
+    }
+
+    uint8_t type = blockHeader[0] & 0x7F;
+    uint32_t len = (uint32_t)blockHeader[1] << 16 | blockHeader[2] << 8 | blockHeader[3];
+    if (type == 0 && len >= 18 && file.read(metadataBuffer, 18) == 18)
+    {
+      // STREAMINFO: a 20 bit sample rate, then a 36 bit sample count
+      const uint8_t *info = metadataBuffer;
+      uint32_t sampleRate = (uint32_t)info[10] << 12 | info[11] << 4 | info[12] >> 4;
+      uint64_t samples = (uint64_t)(info[13] & 0x0F) << 32 | readBE32(info + 14);
+      if (sampleRate > 0)
+      {
+        meta.durationSec = min(samples / sampleRate, (uint64_t)UINT16_MAX);
+      }
+    }
+    else if (type == 4)
+    {
+      size_t read = file.read(metadataBuffer, min(len, (uint32_t)METADATA_BUFFER_LEN));
+      readVorbisComments(metadataBuffer, read, meta);
+    }
+    pos += 4 + len;
+  } while (!(blockHeader[0] & 0x80));
+
+  return true;
+}
+
+// reads as much of the body of the Ogg page at pos as fits, and moves pos to
+// the next page
+size_t readOggPage(fs::File &file, uint32_t &pos, uint8_t *body, size_t maxLen)
+{
+  uint8_t header[27];
+  uint8_t segments[255];
+  file.seek(pos);
+  if (file.read(header, 27) != 27 || memcmp(header, "OggS", 4) != 0 || file.read(segments, header[26]) != header[26])
+  {
+    return 0;
+  }
+
+  uint32_t bodyLen = 0;
+  for (uint8_t i = 0; i < header[26]; i++)
+  {
+    bodyLen += segments[i];
+  }
+  pos += 27 + header[26] + bodyLen;
+  return file.read(body, min(bodyLen, (uint32_t)maxLen));
+}
+
+// the granule position of the last page is the length in samples
+uint64_t readOggLastGranule(fs::File &file)
+{
+  uint32_t size = file.size();
+  uint32_t end = size;
+  while (end > 0 && size - end < METADATA_OGG_TAIL_LEN)
+  {
+    uint32_t start = end > METADATA_BUFFER_LEN ? end - METADATA_BUFFER_LEN : 0;
+    file.seek(start);
+    size_t len = file.read(metadataBuffer, end - start);
+    for (size_t i = len >= 14 ? len - 14 + 1 : 0; i-- > 0;)
+    {
+      if (memcmp(metadataBuffer + i, "OggS", 4) == 0)
+      {
+        return (uint64_t)readLE32(metadataBuffer + i + 10) << 32 | readLE32(metadataBuffer + i + 6);
+      }
+    }
+    if (start == 0)
+    {
+      break;
+    }
+    // overlap so a page header cut by the window is seen in the next one
+    end = start + 13;
+  }
+  return 0;
+}
+
+bool readOgg(fs::File &file, TrackMetadata &meta)
+{
+  uint32_t pos = 0;
+  size_t len = readOggPage(file, pos, metadataBuffer, METADATA_BUFFER_LEN);
+  uint32_t sampleRate;
+  uint32_t preSkip = 0;
+  bool opus = len >= 19 && memcmp(metadataBuffer, "OpusHead", 8) == 0;
+  if (opus)
+  {
+    // Opus granule positions always count at 48 kHz
+    sampleRate = 48000;
+    preSkip = metadataBuffer[10] | metadataBuffer[11] << 8;
+  }
+  else if (len >= 16 && memcmp(metadataBuffer, "\x01vorbis", 7) == 0)
+  {
+    sampleRate = readLE32(metadataBuffer + 12);
+  }
+  else
+  {
+    return false;
+  }
+
+  len = readOggPage(file, pos, metadataBuffer, METADATA_BUFFER_LEN);
+  if (opus && len >= 8 && memcmp(metadataBuffer, "OpusTags", 8) == 0)
+  {
+    readVorbisComments(metadataBuffer + 8, len - 8, meta);
+  }
+  else if (!opus && len >= 7 && memcmp(metadataBuffer, "\x03vorbis", 7) == 0)
+  {
+    readVorbisComments(metadataBuffer + 7, len - 7, meta);
+  }
+
+  uint64_t granule = readOggLastGranule(file);
+  if (sampleRate > 0 && granule > preSkip)
+  {
+    meta.durationSec = min((granule - preSkip) / sampleRate, (uint64_t)UINT16_MAX);
+  }
+  return true;
+}
+
+bool readTrackMetadata(fs::File &file, TrackMetadata &meta)
+{
+  meta.durationSec = TRACK_NO_DURATION;
+  meta.replayGainCentiDb = TRACK_NO_REPLAY_GAIN;
+  meta.title[0] = '\0';
+  meta.artist[0] = '\0';
+  meta.album[0] = '\0';
+
+  uint8_t magic[4];
+  file.seek(0);
+  if (file.read(magic, 4) != 4)
+  {
+    return false;
+  }
+  if (memcmp(magic, "fLaC", 4) == 0)
+  {
+    return readFlac(file, meta);
+  }
+  if (memcmp(magic, "OggS", 4) == 0)
+  {
+    return readOgg(file, meta);
+  }
+  return readMp3(file, meta);
+}
@@ -16,11 +16,16 @@
 
 #define TEN_MIN 600000
 
+// WiFi, lwIP and AsyncTCP run on core 0, so the decoder gets core 1 to itself
+#define AUDIO_TASK_CORE 1
+#define AUDIO_TASK_PRIORITY 6
+#define AUDIO_TASK_STACK_SIZE 8192
+
 Config config;
 AudioPlayer audioPlayer;
 MqttHandler mqttHandler;
 SoundPlayerCommunicationManager communicationManager;
-SensorHandler sensorHandler;
+SensorHandler<DHT11TemperatureSensor> sensorHandler;
 AsyncWebServer server(80);
 
 void connectToWifi();
@@ -36,7 +41,14 @@ void setup()
   connectToWifi();
   delay(500);
 
-  mqttHandler.init(config.mqtt_config);
+  if (!mqttHandler.init(config.mqtt_config))
+  {
+    // nothing can be published or received without the topics
+    for (;;)
+    {
+      delay(1000);
+    }
+  }
 
   audioPlayer.init();
 
@@ -49,13 +61,14 @@ void setup()
 
   startWebServer();
 
-  xTaskCreate(
+  xTaskCreatePinnedToCore(
       startAudioPlayer,
       "Play audio",
-      4096,
+      AUDIO_TASK_STACK_SIZE,
+      NULL,
+      AUDIO_TASK_PRIORITY,
       NULL,
-      10,
-      NULL);
+      AUDIO_TASK_CORE);
   delay(500);
 }
 
@@ -67,6 +80,7 @@ void loop()
   }
 
   sensorHandler.publishAll();
+  deviceState.publish(&mqttHandler);
   delay(TEN_MIN);
 }
 
@@ -92,8 +106,8 @@ void connectToWifi()
 
 void startAudioPlayer(void *parameter)
 {
-  audioPlayer.setPublishStateFn([](String payload)
-                                { communicationManager.publishState(payload); });
+  audioPlayer.setPublishStateFn([](const char *field, const char *payload, size_t length)
+                                { return communicationManager.publishState(field, payload, length); });
   audioPlayer.start();
   for (;;)
   {
@@ -111,18 +125,17 @@ void initCommunicationManager()
 {
   communicationManager.init(
       &mqttHandler,
-      spConfig.MqttTopicSensorTemperature,
-      [](string payload)
-      { audioPlayer.onVolumeChangeRequested(payload); },
-      [](string payload)
-      { audioPlayer.onStateChangeRequested(payload); },
-      [](string payload)
-      { audioPlayer.onGenreChangeRequested(payload); });
+      [](const char *payload, size_t length)
+      { audioPlayer.onVolumeChangeRequested(payload, length); },
+      [](const char *payload, size_t length)
+      { audioPlayer.onStateChangeRequested(payload, length); },
+      [](const char *payload, size_t length)
+      { audioPlayer.onGenreChangeRequested(payload, length); });
 }
 
 void initSensors()
 {
-  TemperatureSensorConfig tempSensorConfig = TemperatureSensorConfig(DHT11Sensor);
+  TemperatureSensorConfig tempSensorConfig;
   tempSensorConfig.DHTPin = 21;
   sensorHandler.init(tempSensorConfig, &communicationManager);
 }
@@ -0,0 +1,155 @@
+#include "ActuatorScheduler.h"
+
+// timer1 counts at 80 MHz / 256, 312.5 ticks per ms, and holds at most 2^23 ticks;
+// longer runs are covered by re-arming until the deadline is reached
+#define ACTUATOR_TIMER_TICKS_PER_10MS 3125
+#define ACTUATOR_TIMER_MAX_MS 25000
+
+ActuatorScheduler *activeScheduler = nullptr;
+
+void IRAM_ATTR onActuatorTimer()
+{
+  activeScheduler->switchOffDue();
+  activeScheduler->armTimer();
+}
+
+void ActuatorScheduler::begin(OnActuatorChange onChange)
+{
+  _onChange = onChange;
+  activeScheduler = this;
+  timer1_attachInterrupt(onActuatorTimer);
+}
+
+int8_t ActuatorScheduler::addChannel(const char *name, uint8_t pin)
+{
+  if (_count >= ACTUATOR_MAX_CHANNELS)
+  {
+    return -1;
+  }
+
+  ActuatorChannel &channel = _channels[_count];
+  channel.name = name;
+  channel.pin = pin;
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+  return _count++;
+}
+
+bool ActuatorScheduler::run(uint8_t channel, uint32_t durationMs)
+{
+  if (channel >= _count || durationMs == 0)
+  {
+    return false;
+  }
+
+  uint32_t now = millis();
+  ActuatorChannel &ch = _channels[channel];
+  noInterrupts();
+  if (!ch.on)
+  {
+    ch.startedMs = now;
+  }
+  // the failsafe counts from when the channel came on, so extending a run cannot get around it
+  uint32_t maxOnMs = ACTUATOR_MAX_ON_MS - min((uint32_t)(now - ch.startedMs), (uint32_t)ACTUATOR_MAX_ON_MS);
+  ch.offAtMs = now + min(durationMs, maxOnMs);
+  ch.on = true;
+  digitalWrite(ch.pin, HIGH);
+  interrupts();
+
+  armTimer();
+  return true;
+}
+
+void ActuatorScheduler::stop(uint8_t channel)
+{
+  if (channel >= _count)
+  {
+    return;
+  }
+
+  noInterrupts();
+  _channels[channel].offAtMs = millis();
+  interrupts();
+  switchOffDue();
+  armTimer();
+}
+
+bool ActuatorScheduler::anyOn()
+{
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_channels[i].on || _channels[i].reportedOn)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// reports what the timer switched, and switches off anything overdue should the timer have missed it
+void ActuatorScheduler::poll()
+{
+  switchOffDue();
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    ActuatorChannel &ch = _channels[i];
+    bool on = ch.on;
+    if (on != ch.reportedOn)
+    {
+      ch.reportedOn = on;
+      if (_onChange != NULL)
+      {
+        _onChange(ch.name, on);
+      }
+    }
+  }
+}
+
+void IRAM_ATTR ActuatorScheduler::switchOffDue()
+{
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    ActuatorChannel &ch = _channels[i];
+    if (ch.on && (int32_t)(now - ch.offAtMs) >= 0)
+    {
+      digitalWrite(ch.pin, LOW);
+      ch.on = false;
+    }
+  }
+}
+
+// one shot for the earliest deadline, or no timer at all while everything is off
+void IRAM_ATTR ActuatorScheduler::armTimer()
+{
+  uint32_t now = millis();
+  uint32_t nextMs = UINT32_MAX;
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    ActuatorChannel &ch = _channels[i];
+    if (ch.on)
+    {
+      int32_t remaining = (int32_t)(ch.offAtMs - now);
+      nextMs = min(nextMs, (uint32_t)max(remaining, (int32_t)1));
+    }
+  }
+
+  if (nextMs == UINT32_MAX)
+  {
+    timer1_disable();
+    return;
+  }
+
+  nextMs = min(nextMs, (uint32_t)ACTUATOR_TIMER_MAX_MS);
+  timer1_enable(TIM_DIV256, TIM_EDGE, TIM_SINGLE);
+  timer1_write(nextMs * ACTUATOR_TIMER_TICKS_PER_10MS / 10 + 1);
+}
+
+uint32_t parseDurationMs(const char *seconds)
+{
+  unsigned long value = strtoul(seconds, NULL, 10);
+  // anything past the failsafe is cut to it anyway, and clamping here keeps the product in range
+  value = min(value, (unsigned long)(ACTUATOR_MAX_ON_MS / 1000));
+  return (uint32_t)value * 1000;
+}
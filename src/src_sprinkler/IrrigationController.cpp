@@ -0,0 +1,100 @@
+#include "IrrigationController.h"
+
+#define IRRIGATION_DEFAULT_INTERVAL_S 86400 // assumed before the first decision
+#define IRRIGATION_MAX_INTERVAL_S (3 * 86400)
+#define IRRIGATION_INTEGRAL_LIMIT 24000 // permille hours
+#define IRRIGATION_WIND_SPEED_CM_S 200 // the FAO-56 default of 2 m/s, there is no anemometer
+
+// saturation vapour pressure in Pa for 0..50 C
+const uint16_t saturationPressure[] = {
+    611, 657, 706, 758, 813, 872, 935, 1002, 1073, 1148, 1228, 1313, 1403, 1498, 1599, 1705, 1818,
+    1938, 2064, 2197, 2338, 2487, 2644, 2809, 2984, 3168, 3361, 3565, 3780, 4006, 4243, 4492, 4755,
+    5030, 5319, 5622, 5941, 6275, 6625, 6991, 7375, 7778, 8199, 8639, 9100, 9582, 10086, 10612, 11162,
+    11737, 12336};
+const int saturationPressureMaxC = sizeof(saturationPressure) / sizeof(saturationPressure[0]) - 1;
+
+template <typename T>
+T clampTo(T value, T low, T high)
+{
+  return value < low ? low : (value > high ? high : value);
+}
+
+// interpolated between whole degrees, in Pa
+int32_t saturationPressureAt(int32_t centiC)
+{
+  centiC = clampTo<int32_t>(centiC, 0, saturationPressureMaxC * 100 - 1);
+  int32_t c = centiC / 100;
+  int32_t fraction = centiC % 100;
+  return saturationPressure[c] + (saturationPressure[c + 1] - saturationPressure[c]) * fraction / 100;
+}
+
+int16_t IrrigationController::toMoisture(uint16_t soilRaw)
+{
+  int32_t range = (int32_t)_config.dryRaw - _config.wetRaw;
+  if (range == 0)
+  {
+    return 0;
+  }
+  int32_t permille = ((int32_t)_config.dryRaw - soilRaw) * 1000 / range;
+  return (int16_t)clampTo<int32_t>(permille, 0, 1000);
+}
+
+// aerodynamic term of the FAO-56 Penman-Monteith equation; with no radiation
+// sensor the radiation term is left out, which the integral makes up for
+uint16_t IrrigationController::estimateEt(int16_t temperatureCentiC, uint16_t humidityPermille, uint32_t pressurePa)
+{
+  int32_t es = saturationPressureAt(temperatureCentiC);
+  int32_t vpd = es * (1000 - (int32_t)clampTo<uint16_t>(humidityPermille, 0, 1000)) / 1000;
+  // slope of the saturation curve, Pa per C
+  int32_t delta = (saturationPressureAt(temperatureCentiC + 50) - saturationPressureAt(temperatureCentiC - 50));
+  // psychrometric constant, Pa per C
+  int32_t gamma = (int32_t)((uint64_t)pressurePa * 665 / 1000000);
+  int32_t kelvinCenti = temperatureCentiC + 27315;
+
+  // ET0 = gamma * 900 / T * u2 * vpd / (delta + gamma * (1 + 0.34 u2)), in 0.01 mm per day
+  int64_t numerator = (int64_t)gamma * 900 * IRRIGATION_WIND_SPEED_CM_S * vpd * 100;
+  int64_t denominator = (int64_t)kelvinCenti * (delta * 100 + gamma * (100 + 34 * IRRIGATION_WIND_SPEED_CM_S / 100)) * 1000 / 100;
+  if (denominator <= 0)
+  {
+    return 0;
+  }
+  return (uint16_t)clampTo<int64_t>(numerator / denominator, 0, 0xFFFF);
+}
+
+IrrigationDecision IrrigationController::decide(const IrrigationInputs &inputs, IrrigationState &state, uint32_t epoch)
+{
+  IrrigationDecision decision;
+  decision.moisturePermille = toMoisture(inputs.soilRaw);
+  decision.etCentiMmPerDay = estimateEt(inputs.temperatureCentiC, inputs.humidityPermille, inputs.pressurePa);
+
+  uint32_t intervalS = state.lastEpoch == 0 || epoch <= state.lastEpoch ? IRRIGATION_DEFAULT_INTERVAL_S : epoch - state.lastEpoch;
+  intervalS = clampTo<uint32_t>(intervalS, 1, IRRIGATION_MAX_INTERVAL_S);
+  state.lastEpoch = epoch;
+
+  int32_t error = (int32_t)_config.setpointPermille - decision.moisturePermille;
+  if (error > -(int32_t)_config.deadbandPermille && error < (int32_t)_config.deadbandPermille)
+  {
+    error = 0;
+  }
+
+  // what the bed is expected to lose until the next decision, assuming the same interval
+  int32_t etLoss = (int32_t)((int64_t)decision.etCentiMmPerDay * intervalS * 10 / (86400LL * _config.rootDepthMm));
+
+  int32_t integral = clampTo<int32_t>(state.integral + (int32_t)((int64_t)error * intervalS / 3600), -IRRIGATION_INTEGRAL_LIMIT, IRRIGATION_INTEGRAL_LIMIT);
+  int32_t demand = ((int32_t)_config.kp * error + (int32_t)_config.ki * integral) / (1 << IRRIGATION_GAIN_SHIFT) + etLoss;
+
+  uint32_t maxRunSec = clampTo<uint32_t>((uint64_t)intervalS * _config.maxDutyPermille / 1000, 0, _config.maxRunSec);
+  int32_t runSec = demand <= 0 ? 0 : (int32_t)((int64_t)demand * _config.pumpSecondsPerPermille / (1 << IRRIGATION_GAIN_SHIFT));
+
+  // anti-windup: while the output is pinned, the integral may shrink back
+  // towards zero but not grow further in the direction it is pinned in
+  bool saturatedHigh = runSec >= (int32_t)maxRunSec && error > 0 && integral > 0;
+  bool saturatedLow = runSec <= 0 && error < 0 && integral < 0;
+  if (!saturatedHigh && !saturatedLow)
+  {
+    state.integral = integral;
+  }
+
+  decision.runSec = (uint16_t)clampTo<int32_t>(runSec, 0, maxRunSec);
+  return decision;
+}
@@ -0,0 +1,277 @@
+#include "WateringSchedule.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <coredecls.h>
+
+#define SCHEDULE_FILE "/schedule.bin"
+#define SCHEDULE_RTC_MAGIC 0x53434831 // "SCH1"
+#define SCHEDULE_EARLY_TOLERANCE_S 60  // the sleep timer drifts, an entry may run this much early
+#define SCHEDULE_LATE_TOLERANCE_S 300  // or this much late, after that it is missed for the day
+#define SCHEDULE_JSON_CAPACITY 3072
+
+static_assert(sizeof(ScheduleEntry) == 8, "schedule entries are packed into RTC memory");
+static_assert(sizeof(ScheduleRtcState) <= 126 * 4, "the last two RTC blocks hold MqttHandler's subscription set");
+static_assert(sizeof(ScheduleRtcState) % 4 == 0, "RTC memory is accessed in 32 bit words");
+static_assert(sizeof(ScheduleRtcState) <= 512, "RTC user memory holds 512 bytes");
+
+uint32_t stateCrc(const ScheduleRtcState &state)
+{
+  const uint8_t *begin = (const uint8_t *)&state.clockEpoch;
+  return crc32(begin, sizeof(ScheduleRtcState) - (begin - (const uint8_t *)&state));
+}
+
+void WateringSchedule::load()
+{
+  if (loadRtc())
+  {
+    if (_state.clockEpoch != 0)
+    {
+      _bootEpoch = _state.clockEpoch + _state.sleepMs / 1000;
+    }
+    return;
+  }
+
+  // cold boot, the RTC memory is lost but the file system is not
+  memset(&_state, 0, sizeof(_state));
+  _state.schedule = Schedule();
+  _state.wakeWithRadio = 1; // a power on always has the radio
+  if (!loadFile())
+  {
+    Serial.println("No watering schedule stored yet.");
+  }
+  saveRtc();
+}
+
+bool WateringSchedule::loadRtc()
+{
+  if (!ESP.rtcUserMemoryRead(0, (uint32_t *)&_state, sizeof(_state)))
+  {
+    return false;
+  }
+  return _state.magic == SCHEDULE_RTC_MAGIC && _state.crc == stateCrc(_state);
+}
+
+void WateringSchedule::saveRtc()
+{
+  _state.magic = SCHEDULE_RTC_MAGIC;
+  _state.crc = stateCrc(_state);
+  ESP.rtcUserMemoryWrite(0, (uint32_t *)&_state, sizeof(_state));
+}
+
+bool WateringSchedule::loadFile()
+{
+  if (!LittleFS.begin())
+  {
+    return false;
+  }
+
+  File file = LittleFS.open(SCHEDULE_FILE, "r");
+  if (!file)
+  {
+    return false;
+  }
+  Schedule schedule;
+  bool ok = file.read((uint8_t *)&schedule, sizeof(schedule)) == sizeof(schedule) && schedule.count <= SCHEDULE_MAX_ENTRIES;
+  file.close();
+  if (ok)
+  {
+    _state.schedule = schedule;
+  }
+  return ok;
+}
+
+bool WateringSchedule::saveFile()
+{
+  if (!LittleFS.begin())
+  {
+    return false;
+  }
+
+  File file = LittleFS.open(SCHEDULE_FILE, "w");
+  if (!file)
+  {
+    Serial.println("Unable to write the watering schedule.");
+    return false;
+  }
+  bool ok = file.write((const uint8_t *)&_state.schedule, sizeof(Schedule)) == sizeof(Schedule);
+  file.close();
+  return ok;
+}
+
+// {"tz": -480, "sync": 30, "entries": [{"zone": 0, "days": 127, "start": "06:30",
+//  "duration": 300, "skip_below_c": 5, "skip_above_humidity": 90}]}
+// an entry with "auto": true instead of a duration is sized by the irrigation controller
+bool WateringSchedule::update(const char *json, size_t length)
+{
+  DynamicJsonDocument doc(SCHEDULE_JSON_CAPACITY);
+  DeserializationError error = deserializeJson(doc, json, length);
+  if (error)
+  {
+    Serial.printf("Invalid watering schedule: %s\n", error.c_str());
+    return false;
+  }
+
+  Schedule schedule;
+  schedule.tzOffsetMin = doc["tz"] | 0;
+  schedule.syncIntervalMin = doc["sync"] | SPRINKLER_SYNC_INTERVAL_MIN;
+  for (JsonObject item : doc["entries"].as<JsonArray>())
+  {
+    if (schedule.count == SCHEDULE_MAX_ENTRIES)
+    {
+      Serial.printf("Watering schedule is limited to %d entries.\n", SCHEDULE_MAX_ENTRIES);
+      break;
+    }
+
+    unsigned int hour = 0, minute = 0;
+    sscanf(item["start"] | "00:00", "%u:%u", &hour, &minute);
+
+    ScheduleEntry &entry = schedule.entries[schedule.count++];
+    entry.zone = item["zone"] | 0;
+    entry.days = item["days"] | 0x7F;
+    entry.startMinute = (hour % 24) * 60 + minute % 60;
+    entry.durationSec = (item["auto"] | false) ? SCHEDULE_AUTO_DURATION : (item["duration"] | 0);
+    entry.skipBelowC = item["skip_below_c"] | SCHEDULE_NO_TEMPERATURE_LIMIT;
+    entry.skipAboveHumidity = item["skip_above_humidity"] | SCHEDULE_NO_HUMIDITY_LIMIT;
+  }
+
+  // entries that did not change keep their run marks, so a resent schedule never waters twice
+  Schedule &current = _state.schedule;
+  int changed = 0;
+  for (int i = 0; i < SCHEDULE_MAX_ENTRIES; i++)
+  {
+    bool inCurrent = i < current.count;
+    bool inUpdate = i < schedule.count;
+    if (inCurrent != inUpdate || (inUpdate && memcmp(&current.entries[i], &schedule.entries[i], sizeof(ScheduleEntry)) != 0))
+    {
+      _state.lastRunDay[i] = 0;
+      changed++;
+    }
+  }
+  bool settingsChanged = current.tzOffsetMin != schedule.tzOffsetMin || current.syncIntervalMin != schedule.syncIntervalMin;
+
+  if (changed == 0 && !settingsChanged)
+  {
+    Serial.println("Watering schedule unchanged.");
+    return false;
+  }
+
+  _state.schedule = schedule;
+  saveFile();
+  saveRtc();
+  Serial.printf("Watering schedule updated, %d of %d entries changed.\n", changed, schedule.count);
+  return true;
+}
+
+uint32_t WateringSchedule::now()
+{
+  return _bootEpoch == 0 ? 0 : _bootEpoch + millis() / 1000;
+}
+
+bool WateringSchedule::clockValid()
+{
+  return _bootEpoch != 0;
+}
+
+void WateringSchedule::setClock(uint32_t epoch)
+{
+  _bootEpoch = epoch - millis() / 1000;
+}
+
+void WateringSchedule::markSynced()
+{
+  _state.lastSyncEpoch = now();
+}
+
+bool WateringSchedule::syncDue()
+{
+  return !clockValid() || now() - _state.lastSyncEpoch >= _state.schedule.syncIntervalMin * 60UL;
+}
+
+bool WateringSchedule::radioAvailable()
+{
+  return _state.wakeWithRadio != 0;
+}
+
+void WateringSchedule::runDue(const ScheduleConditions &conditions, OnScheduleEntryDue onDue)
+{
+  if (!clockValid())
+  {
+    return;
+  }
+
+  uint32_t local = now() + _state.schedule.tzOffsetMin * 60L;
+  uint16_t day = local / 86400;
+  uint32_t secondOfDay = local % 86400;
+  uint8_t weekday = (day + 4) % 7; // 1 January 1970 was a Thursday
+
+  for (int i = 0; i < _state.schedule.count; i++)
+  {
+    const ScheduleEntry &entry = _state.schedule.entries[i];
+    int32_t offset = (int32_t)secondOfDay - entry.startMinute * 60L;
+    if (!(entry.days & (1 << weekday)) || _state.lastRunDay[i] == day || offset < -SCHEDULE_EARLY_TOLERANCE_S || offset > SCHEDULE_LATE_TOLERANCE_S)
+    {
+      continue;
+    }
+
+    _state.lastRunDay[i] = day;
+    if (entry.skipBelowC != SCHEDULE_NO_TEMPERATURE_LIMIT && conditions.temperatureC < entry.skipBelowC)
+    {
+      Serial.printf("Skipping zone %d, it is %.1f C.\n", entry.zone, conditions.temperatureC);
+      continue;
+    }
+    if (entry.skipAboveHumidity != SCHEDULE_NO_HUMIDITY_LIMIT && conditions.humidity > entry.skipAboveHumidity)
+    {
+      Serial.printf("Skipping zone %d, humidity is %.0f%%.\n", entry.zone, conditions.humidity);
+      continue;
+    }
+    onDue(entry);
+  }
+  saveRtc();
+}
+
+uint32_t WateringSchedule::secondsUntilNextWake(bool &needsRadio)
+{
+  needsRadio = true;
+  if (!clockValid())
+  {
+    return _state.schedule.syncIntervalMin * 60UL;
+  }
+
+  uint32_t current = now();
+  uint32_t syncAt = _state.lastSyncEpoch + _state.schedule.syncIntervalMin * 60UL;
+  uint32_t best = syncAt > current ? syncAt - current : 0;
+
+  int32_t tzOffsetS = _state.schedule.tzOffsetMin * 60L;
+  uint32_t local = current + tzOffsetS;
+  uint16_t today = local / 86400;
+
+  // a week ahead covers every entry
+  for (uint16_t day = today; day <= today + 7; day++)
+  {
+    uint8_t weekday = (day + 4) % 7;
+    for (int i = 0; i < _state.schedule.count; i++)
+    {
+      const ScheduleEntry &entry = _state.schedule.entries[i];
+      if (!(entry.days & (1 << weekday)) || _state.lastRunDay[i] == day)
+      {
+        continue;
+      }
+
+      uint32_t at = day * 86400UL + entry.startMinute * 60UL - tzOffsetS;
+      if (at > current && at - current < best)
+      {
+        best = at - current;
+        needsRadio = false;
+      }
+    }
+  }
+  return best;
+}
+
+void WateringSchedule::prepareSleep(uint32_t sleepMs, bool withRadio)
+{
+  _state.clockEpoch = now();
+  _state.sleepMs = sleepMs;
+  _state.wakeWithRadio = withRadio;
+  saveRtc();
+}
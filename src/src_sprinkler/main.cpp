@@ -4,100 +4,180 @@
 #include "MqttHandler.h"
 #include "SensorHandler.h"
 #include "CommunicationManager.h"
+#include "ActuatorScheduler.h"
+#include "WateringSchedule.h"
+#include "IrrigationController.h"
+#include <time.h>
 
-#define TEN_MIN_IN_US 600000000
+#define LISTEN_TIMEOUT_MS 10000 // in case the subscriptions never complete
+#define LISTEN_SETTLE_MS 500    // for the retained and queued messages following the acknowledgements
+#define NTP_TIMEOUT_MS 5000
+#define MIN_SLEEP_MS 1000
 
 Config config;
 SprinklerConfig sprinklerConfig;
 MqttHandler mqttHandler;
 SprinklerCommunicationManager communicationManager;
-SensorHandler sensorHandler;
-bool doWater = false;
-int waterOnDurationInMs = 0;
-bool doFan = false;
-int fanOnDurationInMs = 0;
+SensorHandler<BME280TemperatureSensor> sensorHandler;
+ActuatorScheduler actuatorScheduler;
+WateringSchedule wateringSchedule;
+IrrigationController irrigationController;
+BME280TemperatureSensor *weatherSensor;
+int8_t waterChannel;
+int8_t fanChannel;
+bool syncing;
+unsigned long listenUntilMs;
 
 // functions declaration
 void connectToWifi();
-void initMqttHandler();
+bool initMqttHandler();
 void initSensorHandler();
 void initCommunicationManager();
-void turnOnWater();
-void turnOffWater();
-void turnOnFan();
-void turnOffFan();
+void initActuatorScheduler();
+void syncClock();
+void runSchedule();
+uint32_t entryDurationMs(const ScheduleEntry &);
+void sleepUntilNextWake();
 
 void setup()
 {
   Serial.begin(9600);
-  pinMode(sprinklerConfig.WaterPumpPin, OUTPUT);
-  pinMode(sprinklerConfig.FanPin, OUTPUT);
+  initActuatorScheduler();
+  initSensorHandler();
+  wateringSchedule.load();
 
-  connectToWifi();
-  delay(500);
+  // most wakes only run the schedule and never bring the radio up
+  syncing = wateringSchedule.syncDue() && wateringSchedule.radioAvailable();
+  if (syncing)
+  {
+    connectToWifi();
+    delay(500);
 
-  initMqttHandler();
-  delay(500);
+    // the schedule still runs without its topics, only the sync is skipped
+    syncing = initMqttHandler();
+    delay(500);
+  }
+  if (!syncing)
+  {
+    WiFi.mode(WIFI_OFF);
+    listenUntilMs = millis();
+    runSchedule();
+    return;
+  }
 
   initCommunicationManager();
 
-  initSensorHandler();
-
+  // requests for program upload, watering and schedule changes start right
+  // away and run side by side; the node stays up until they have arrived
+  listenUntilMs = millis() + LISTEN_TIMEOUT_MS;
+  mqttHandler.onSubscriptionsReady([](bool allGranted)
+                                   { listenUntilMs = millis() + LISTEN_SETTLE_MS; });
   mqttHandler.connect();
   delay(500);
 
+  syncClock();
+
   communicationManager.publishState("esp_board", "on");
+#ifndef MQTT_AGGREGATE_STATE
   delay(500);
+#endif
 
   sensorHandler.publishAll();
-  delay(500);
+  runSchedule();
+}
 
-  // wait 10s for program upload and watering requests
-  unsigned long tStart = millis();
-  while (millis() - tStart < 10000)
+void loop()
+{
+  actuatorScheduler.poll();
+
+  if ((long)(millis() - listenUntilMs) >= 0 && !actuatorScheduler.anyOn())
   {
-    delay(1000);
+    sleepUntilNextWake();
   }
+  delay(10);
+}
 
-  // turn water on based on for requested duration
-  if (doWater && waterOnDurationInMs > 0)
+// wakes exactly when the next entry or sync is due, with the radio only for a sync
+void sleepUntilNextWake()
+{
+  if (syncing)
   {
-    turnOnWater();
-    tStart = millis();
-    while (millis() - tStart < waterOnDurationInMs)
-    {
-      delay(1000);
-    }
-    waterOnDurationInMs = 0;
-    turnOffWater();
-    doWater = false;
+    communicationManager.publishState("esp_board", "off");
+    deviceState.publish(&mqttHandler);
+    delay(500);
   }
 
-  delay(1000);
+  bool withRadio;
+  uint64_t sleepMs = (uint64_t)wateringSchedule.secondsUntilNextWake(withRadio) * 1000;
+  uint64_t maxSleepMs = ESP.deepSleepMax() / 1000;
+  if (sleepMs > maxSleepMs)
+  {
+    // an intermediate wake with nothing to do but sleep again
+    sleepMs = maxSleepMs;
+    withRadio = false;
+  }
+  sleepMs = max(sleepMs, (uint64_t)MIN_SLEEP_MS);
+
+  Serial.printf("Sleeping for %u s%s.\n", (unsigned)(sleepMs / 1000), withRadio ? ", then syncing" : "");
+  wateringSchedule.prepareSleep(sleepMs, withRadio);
+  ESP.deepSleep(sleepMs * 1000, withRadio ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
 
-  // turn fan on based on temperature (detected in HA)
-  if (doFan && fanOnDurationInMs > 0)
+void syncClock()
+{
+  configTime(0, 0, "pool.ntp.org");
+  unsigned long tStart = millis();
+  while (time(nullptr) < 1600000000 && millis() - tStart < NTP_TIMEOUT_MS)
   {
-    turnOnFan();
-    tStart = millis();
-    while (millis() - tStart < fanOnDurationInMs)
-    {
-      delay(1000);
-    }
-    fanOnDurationInMs = 0;
-    turnOffFan();
-    doFan = false;
+    delay(100);
   }
 
-  communicationManager.publishState("esp_board", "off");
-  delay(500);
+  if (time(nullptr) >= 1600000000)
+  {
+    wateringSchedule.setClock(time(nullptr));
+  }
+  else
+  {
+    Serial.println("NTP sync failed, keeping the estimated clock.");
+  }
+  wateringSchedule.markSynced();
+}
+
+void runSchedule()
+{
+  ScheduleConditions conditions = {NAN, NAN};
+  if (weatherSensor != nullptr)
+  {
+    conditions.temperatureC = weatherSensor->readTemperature();
+    conditions.humidity = weatherSensor->readHumidity();
+  }
 
-  ESP.deepSleep(TEN_MIN_IN_US);
+  wateringSchedule.runDue(conditions, [](const ScheduleEntry &entry)
+                          { actuatorScheduler.run(entry.zone, entryDurationMs(entry)); });
 }
 
-void loop()
+uint32_t entryDurationMs(const ScheduleEntry &entry)
 {
-  delay(1000);
+  if (entry.durationSec != SCHEDULE_AUTO_DURATION)
+  {
+    return entry.durationSec * 1000UL;
+  }
+
+  // a missing reading falls back to a mild day at sea level
+  float temperature = weatherSensor != nullptr ? weatherSensor->readTemperature() : NAN;
+  float humidity = weatherSensor != nullptr ? weatherSensor->readHumidity() : NAN;
+  float pressure = weatherSensor != nullptr ? weatherSensor->readPressure() : NAN;
+
+  IrrigationInputs inputs;
+  inputs.soilRaw = analogRead(A0);
+  inputs.temperatureCentiC = isnan(temperature) ? 2000 : (int16_t)lroundf(temperature * 100);
+  inputs.humidityPermille = isnan(humidity) ? 500 : (uint16_t)lroundf(humidity * 10);
+  inputs.pressurePa = isnan(pressure) ? 101325 : (uint32_t)lroundf(pressure * 100);
+
+  IrrigationDecision decision = irrigationController.decide(inputs, wateringSchedule._state.irrigation, wateringSchedule.now());
+  Serial.printf("Soil moisture %d permille, ET %d.%02d mm/day, running zone %d for %d s.\n",
+                decision.moisturePermille, decision.etCentiMmPerDay / 100, decision.etCentiMmPerDay % 100, entry.zone, decision.runSec);
+  return decision.runSec * 1000UL;
 }
 
 void connectToWifi()
@@ -116,69 +196,55 @@ void connectToWifi()
   Serial.println(WiFi.localIP());
 }
 
-void turnOnFan()
-{
-  digitalWrite(sprinklerConfig.FanPin, HIGH);
-  delay(250);
-  communicationManager.publishState("fan", "on");
-  delay(250);
-}
-
-void turnOffFan()
-{
-  digitalWrite(sprinklerConfig.FanPin, LOW);
-  delay(250);
-  communicationManager.publishState("fan", "off");
-  delay(250);
-}
-
-void onFanRequest(std::string payload)
+void onFanRequest(const char *payload, size_t length)
 {
-  doFan = true;
-  fanOnDurationInMs = std::stoi(payload) * 1000;
+  actuatorScheduler.run(fanChannel, parseDurationMs(payload));
 }
 
-void turnOnWater()
+void onWaterRequest(const char *payload, size_t length)
 {
-  digitalWrite(sprinklerConfig.WaterPumpPin, HIGH);
-  delay(250);
-  communicationManager.publishState("water_pump", "on");
-  delay(250);
+  actuatorScheduler.run(waterChannel, parseDurationMs(payload));
 }
 
-void turnOffWater()
+void onScheduleRequest(const char *payload, size_t length)
 {
-  digitalWrite(sprinklerConfig.WaterPumpPin, LOW);
-  delay(250);
-  communicationManager.publishState("water_pump", "off");
-  delay(250);
+  wateringSchedule.update(payload, length);
 }
 
-void onWaterRequest(std::string payload)
+void initActuatorScheduler()
 {
-  doWater = true;
-  waterOnDurationInMs = std::stoi(payload) * 1000;
+  // runs on radio-free wakes are only logged, the next sync reports the sensors
+  actuatorScheduler.begin([](const char *name, bool on)
+                          {
+                            Serial.printf("%s is %s.\n", name, on ? "on" : "off");
+                            if (syncing)
+                            {
+                              communicationManager.publishState(name, on ? "on" : "off");
+                            } });
+  waterChannel = actuatorScheduler.addChannel("water_pump", sprinklerConfig.WaterPumpPin);
+  fanChannel = actuatorScheduler.addChannel("fan", sprinklerConfig.FanPin);
 }
 
-void initMqttHandler()
+bool initMqttHandler()
 {
   config.mqtt_config.cleanSession = false;
-  mqttHandler.init(config.mqtt_config);
+  return mqttHandler.init(config.mqtt_config);
 }
 
 void initCommunicationManager()
 {
   communicationManager.init(
       &mqttHandler,
-      sprinklerConfig.MqttTopicSensorTemperature,
       onWaterRequest,
-      onFanRequest);
+      onFanRequest,
+      onScheduleRequest);
 }
 
 void initSensorHandler()
 {
-  TemperatureSensorConfig sensorConfig = TemperatureSensorConfig(BME280Sensor);
+  TemperatureSensorConfig sensorConfig;
   sensorConfig.SCLPin = sprinklerConfig.BMESCLPin;
   sensorConfig.SDAPin = sprinklerConfig.BMESDAPin;
-  sensorHandler.init(sensorConfig, &communicationManager);
+  weatherSensor = BME280TemperatureSensor::create(sensorConfig);
+  sensorHandler.init(weatherSensor, &communicationManager);
 }
@@ -13,7 +13,7 @@ WiFiEventHandler wifiConnectHandler;
 WiFiEventHandler wifiDisconnectHandler;
 MqttHandler mqttHandler;
 TempSensorCommunicationManager tempCommMgr;
-SensorHandler sensorHandler;
+SensorHandler<AHT21Sensor> sensorHandler;
 
 // functions declaration
 void connectToWifi();
@@ -25,9 +25,16 @@ void setup()
 {
   Serial.begin(9600);
 
-  mqttHandler.init(config.mqtt_config);
+  if (!mqttHandler.init(config.mqtt_config))
+  {
+    // nothing can be published or received without the topics
+    for (;;)
+    {
+      delay(1000);
+    }
+  }
 
-  tempCommMgr.init(&mqttHandler, MQTT_TOPIC_SENSOR_TEMPERATURE);
+  tempCommMgr.init(&mqttHandler);
 
   initSensors();
 
@@ -44,6 +51,7 @@ void loop()
   delay(500);
 
   sensorHandler.publishAll();
+  deviceState.publish(&mqttHandler);
   delay(500);
 
   mqttHandler.disconnect();
@@ -87,6 +95,6 @@ void onWifiDisconnect(const WiFiEventStationModeDisconnected &event)
 
 void initSensors()
 {
-  TemperatureSensorConfig tempConfig = TemperatureSensorConfig(AHT21);
+  TemperatureSensorConfig tempConfig;
   sensorHandler.init(tempConfig, &tempCommMgr);
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <algorithm>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the little of the Arduino core the modules under host test use, their
+// logging goes to stdout
+struct HostSerial
+{
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+  }
+
+  void println(const char *text)
+  {
+    puts(text);
+  }
+};
+
+static HostSerial Serial __attribute__((unused));
+
+using std::max;
+using std::min;
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// the host has no PSRAM, so asking for it takes the internal RAM fallback
+inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+  return (caps & MALLOC_CAP_SPIRAM) ? nullptr : malloc(size);
+}
+
+inline void heap_caps_free(void *ptr)
+{
+  free(ptr);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "AudioDsp.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES
+#endif
+
+#define BENCH_FRAMES 4096
+#define BENCH_ROUNDS 200
+#define FRAME_PERIOD_NS (1000000000.0 / 44100)
+
+int16_t benchInput[2 * BENCH_FRAMES];
+alignas(uint32_t) int16_t benchFrames[2 * BENCH_FRAMES]; // handed over a frame at a time as a uint32_t, like I2S samples
+AudioDsp benchDsp;
+
+void setUp() {}
+void tearDown() {}
+
+// a -6 dBFS tone per channel, different on each side
+void fillTone()
+{
+  for (int i = 0; i < BENCH_FRAMES; i++)
+  {
+    benchInput[2 * i] = (int16_t)(16384 * sinf(2 * (float)M_PI * 440 * i / 44100));
+    benchInput[2 * i + 1] = (int16_t)(16384 * sinf(2 * (float)M_PI * 1000 * i / 44100));
+  }
+}
+
+void test_silence_stays_silent()
+{
+  AudioDsp dsp;
+  dsp.setEq(6, -3, 6);
+  dsp.setVolume(21);
+  dsp.beginTrack(600);
+
+  int16_t frames[2 * 256] = {};
+  dsp.process(frames, 256);
+  for (int16_t sample : frames)
+  {
+    TEST_ASSERT_EQUAL_INT16(0, sample);
+  }
+}
+
+// the decoder's I2S hook as the firmware has it, one call per frame
+__attribute__((noinline)) void processI2SFrame(uint32_t *sample)
+{
+  benchDsp.process((int16_t *)sample, 1);
+}
+
+// the whole stage with every EQ band active, the worst case per frame, called
+// a frame at a time like the decoder does
+void test_cycles_per_frame()
+{
+  benchDsp.setEq(4, -2, 3);
+  benchDsp.setVolume(15);
+  benchDsp.beginTrack(200);
+  fillTone();
+
+  double totalNs = 0;
+  uint64_t totalCycles = 0;
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    memcpy(benchFrames, benchInput, sizeof(benchFrames));
+    auto start = std::chrono::steady_clock::now();
+#ifdef BENCH_HAS_CYCLES
+    uint64_t startCycles = __rdtsc();
+#endif
+    for (int i = 0; i < BENCH_FRAMES; i++)
+    {
+      processI2SFrame((uint32_t *)&benchFrames[2 * i]);
+    }
+#ifdef BENCH_HAS_CYCLES
+    totalCycles += __rdtsc() - startCycles;
+#endif
+    totalNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  double frames = (double)BENCH_FRAMES * BENCH_ROUNDS;
+  char message[128];
+  snprintf(message, sizeof(message), "AudioDsp: %.1f ns per frame call on the host, %.2f%% of the 44.1 kHz frame period",
+           totalNs / frames, 100 * totalNs / frames / FRAME_PERIOD_NS);
+  TEST_MESSAGE(message);
+#ifdef BENCH_HAS_CYCLES
+  snprintf(message, sizeof(message), "AudioDsp: %.1f TSC cycles per frame call", totalCycles / frames);
+  TEST_MESSAGE(message);
+#endif
+
+  // a host figure; the stage has to stay far below the period to fit on the ESP32
+  TEST_ASSERT_TRUE(totalNs / frames < FRAME_PERIOD_NS);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_silence_stays_silent);
+  RUN_TEST(test_cycles_per_frame);
+  return UNITY_END();
+}
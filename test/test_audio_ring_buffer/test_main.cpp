@@ -0,0 +1,159 @@
+#include <unity.h>
+#include <thread>
+#include "AudioRingBuffer.h"
+
+#define RING_CAPACITY 4096
+#define RING_FALLBACK_CAPACITY 1024
+#define STREAM_BYTES (64 * 1024)
+
+void setUp() {}
+void tearDown() {}
+
+// a byte stream that tells where in it a byte belongs
+uint8_t streamByte(size_t position)
+{
+  return (uint8_t)(position * 7 + (position >> 8));
+}
+
+// fills as much as fits in one region, up to chunk bytes
+size_t produce(AudioRingBuffer &ring, size_t &produced, size_t chunk)
+{
+  uint8_t *ptr;
+  size_t len = min(ring.writeRegion(&ptr), min(chunk, (size_t)STREAM_BYTES - produced));
+  for (size_t i = 0; i < len; i++)
+  {
+    ptr[i] = streamByte(produced + i);
+  }
+  ring.commitWrite(len);
+  produced += len;
+  return len;
+}
+
+// drains one region, up to chunk bytes, and checks every byte is in its place
+bool consume(AudioRingBuffer &ring, size_t &consumed, size_t chunk)
+{
+  uint8_t *ptr;
+  size_t len = min(ring.readRegion(&ptr), chunk);
+  bool inOrder = true;
+  for (size_t i = 0; i < len; i++)
+  {
+    inOrder = inOrder && ptr[i] == streamByte(consumed + i);
+  }
+  ring.commitRead(len);
+  consumed += len;
+  return inOrder;
+}
+
+// the host has no PSRAM, like a board without it
+void test_falls_back_to_internal_ram()
+{
+  AudioRingBuffer ring;
+  TEST_ASSERT_TRUE(ring.init(RING_CAPACITY, RING_FALLBACK_CAPACITY));
+  TEST_ASSERT_EQUAL(RING_FALLBACK_CAPACITY, ring.capacity());
+  TEST_ASSERT_EQUAL(0, ring.available());
+  TEST_ASSERT_EQUAL(RING_FALLBACK_CAPACITY, ring.space());
+}
+
+// regions stop at the end of the buffer, the rest follows from the start
+void test_regions_wrap_around()
+{
+  AudioRingBuffer ring;
+  ring.init(RING_CAPACITY, RING_FALLBACK_CAPACITY);
+  uint8_t *ptr;
+
+  ring.commitWrite(1000);
+  ring.commitRead(900);
+  TEST_ASSERT_EQUAL(100, ring.available());
+
+  TEST_ASSERT_EQUAL(24, ring.writeRegion(&ptr));
+  TEST_ASSERT_TRUE(ptr == ring._buf + 1000);
+  ring.commitWrite(24);
+
+  TEST_ASSERT_EQUAL(900, ring.writeRegion(&ptr));
+  TEST_ASSERT_TRUE(ptr == ring._buf);
+  ring.commitWrite(900);
+  TEST_ASSERT_EQUAL(0, ring.space());
+  TEST_ASSERT_EQUAL(0, ring.writeRegion(&ptr));
+
+  TEST_ASSERT_EQUAL(124, ring.readRegion(&ptr));
+  TEST_ASSERT_TRUE(ptr == ring._buf + 900);
+  ring.commitRead(124);
+  TEST_ASSERT_EQUAL(900, ring.readRegion(&ptr));
+  TEST_ASSERT_TRUE(ptr == ring._buf);
+}
+
+void test_clear_empties_the_ring()
+{
+  AudioRingBuffer ring;
+  ring.init(RING_CAPACITY, RING_FALLBACK_CAPACITY);
+  ring.commitWrite(300);
+  ring.commitRead(100);
+
+  ring.clear();
+  TEST_ASSERT_EQUAL(0, ring.available());
+  TEST_ASSERT_EQUAL(RING_FALLBACK_CAPACITY, ring.space());
+}
+
+// uneven network reads against uneven decoder reads, as the proxy sees them
+void test_stream_comes_out_in_order()
+{
+  AudioRingBuffer ring;
+  ring.init(RING_CAPACITY, RING_FALLBACK_CAPACITY);
+  size_t produced = 0;
+  size_t consumed = 0;
+  size_t writes[] = {1460, 512, 3, 700};
+  size_t reads[] = {2048, 1, 333};
+
+  for (uint32_t step = 0; consumed < STREAM_BYTES; step++)
+  {
+    produce(ring, produced, writes[step % 4]);
+    TEST_ASSERT_TRUE(ring.available() <= ring.capacity());
+    TEST_ASSERT_TRUE(consume(ring, consumed, reads[step % 3]));
+  }
+  TEST_ASSERT_EQUAL(STREAM_BYTES, produced);
+  TEST_ASSERT_EQUAL(0, ring.available());
+}
+
+// the network task fills while the decoder side drains
+void test_stream_survives_two_tasks()
+{
+  AudioRingBuffer ring;
+  ring.init(RING_CAPACITY, RING_FALLBACK_CAPACITY);
+  size_t produced = 0;
+  size_t consumed = 0;
+  bool inOrder = true;
+
+  std::thread network([&]()
+                      {
+                        while (produced < STREAM_BYTES)
+                        {
+                          if (produce(ring, produced, 1460) == 0)
+                          {
+                            std::this_thread::yield();
+                          }
+                        } });
+  while (consumed < STREAM_BYTES)
+  {
+    size_t before = consumed;
+    inOrder = consume(ring, consumed, 2048) && inOrder;
+    if (consumed == before)
+    {
+      std::this_thread::yield();
+    }
+  }
+  network.join();
+
+  TEST_ASSERT_TRUE(inOrder);
+  TEST_ASSERT_EQUAL(STREAM_BYTES, consumed);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_falls_back_to_internal_ram);
+  RUN_TEST(test_regions_wrap_around);
+  RUN_TEST(test_clear_empties_the_ring);
+  RUN_TEST(test_stream_comes_out_in_order);
+  RUN_TEST(test_stream_survives_two_tasks);
+  return UNITY_END();
+}
@@ -0,0 +1,120 @@
+#include <unity.h>
+#include "IrrigationController.h"
+
+#define DECISION_INTERVAL_S (6 * 3600)
+#define SIMULATED_DAYS 60
+// the probe resolves about 2 permille per ADC count and a pump run rounds to
+// whole seconds, so a reading may land this far outside the deadband
+#define MEASUREMENT_TOLERANCE_PERMILLE 5
+
+void setUp() {}
+void tearDown() {}
+
+// a bucket of soil: evapotranspiration drains it, the pump fills it, and
+// anything above field capacity runs off
+struct SoilBed
+{
+  IrrigationConfig config;
+  float moisturePermille;
+  float etScale; // actual loss over the controller's estimate, the radiation it leaves out
+
+  uint16_t soilRaw()
+  {
+    return (uint16_t)(config.dryRaw - moisturePermille * (config.dryRaw - config.wetRaw) / 1000);
+  }
+
+  void water(uint16_t runSec)
+  {
+    moisturePermille += runSec * 256.0f / config.pumpSecondsPerPermille;
+  }
+
+  void evaporate(uint16_t etCentiMmPerDay, uint32_t seconds)
+  {
+    float lostMm = etScale * etCentiMmPerDay / 100.0f * seconds / 86400;
+    moisturePermille -= lostMm * 1000 / config.rootDepthMm;
+  }
+
+  void settle()
+  {
+    moisturePermille = moisturePermille < 0 ? 0 : (moisturePermille > 1000 ? 1000 : moisturePermille);
+  }
+};
+
+// a warm, dry day and a cool, humid night
+IrrigationInputs weatherAt(uint32_t step, uint16_t soilRaw)
+{
+  bool day = step % 4 == 1 || step % 4 == 2;
+  IrrigationInputs inputs;
+  inputs.soilRaw = soilRaw;
+  inputs.temperatureCentiC = day ? 3000 : 1600;
+  inputs.humidityPermille = day ? 350 : 750;
+  inputs.pressurePa = 101325;
+  return inputs;
+}
+
+// moisture has to be in the deadband from settleDays on
+void simulate(float startPermille, float etScale, uint32_t settleDays)
+{
+  IrrigationController controller;
+  IrrigationState state;
+  SoilBed bed{controller._config, startPermille, etScale};
+  const IrrigationConfig &config = controller._config;
+  uint32_t maxRunSec = DECISION_INTERVAL_S * config.maxDutyPermille / 1000;
+  if (maxRunSec > config.maxRunSec)
+  {
+    maxRunSec = config.maxRunSec;
+  }
+
+  uint32_t epoch = 1700000000;
+  for (uint32_t step = 0; step < SIMULATED_DAYS * 4; step++, epoch += DECISION_INTERVAL_S)
+  {
+    IrrigationDecision decision = controller.decide(weatherAt(step, bed.soilRaw()), state, epoch);
+
+    TEST_ASSERT_LESS_OR_EQUAL(maxRunSec, decision.runSec);
+    if (step >= settleDays * 4)
+    {
+      TEST_ASSERT_INT_WITHIN(config.deadbandPermille + MEASUREMENT_TOLERANCE_PERMILLE, config.setpointPermille, decision.moisturePermille);
+    }
+
+    bed.water(decision.runSec);
+    bed.evaporate(decision.etCentiMmPerDay, DECISION_INTERVAL_S);
+    bed.settle();
+  }
+}
+
+void test_dry_bed_is_brought_into_the_deadband()
+{
+  simulate(100, 1.0f, 14);
+}
+
+void test_wet_bed_dries_into_the_deadband()
+{
+  // there is no way to dry it faster than the weather does
+  simulate(600, 1.0f, 21);
+}
+
+// the integral makes up for the loss the ET estimate does not see
+void test_unmodelled_loss_is_made_up_for()
+{
+  simulate(300, 1.5f, 14);
+}
+
+void test_runs_stop_above_the_setpoint()
+{
+  IrrigationController controller;
+  IrrigationState state;
+  SoilBed bed{controller._config, 700, 1.0f};
+
+  IrrigationDecision decision = controller.decide(weatherAt(1, bed.soilRaw()), state, 1700000000);
+  TEST_ASSERT_EQUAL(0, decision.runSec);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_dry_bed_is_brought_into_the_deadband);
+  RUN_TEST(test_wet_bed_dries_into_the_deadband);
+  RUN_TEST(test_unmodelled_loss_is_made_up_for);
+  RUN_TEST(test_runs_stop_above_the_setpoint);
+  return UNITY_END();
+}
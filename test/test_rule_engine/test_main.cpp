@@ -0,0 +1,185 @@
+#include <unity.h>
+#include "RuleEngine.h"
+
+#define FAN_TOPIC "home/sprinkler/fan"
+#define PICTURE_TOPIC "home/camstream/picture"
+
+uint8_t fanCalls;
+char fanPayload[RULE_PAYLOAD_MAX_LEN];
+uint8_t pictureCalls;
+char subscribed[128];
+
+void setUp()
+{
+  fanCalls = 0;
+  fanPayload[0] = '\0';
+  pictureCalls = 0;
+  subscribed[0] = '\0';
+}
+void tearDown() {}
+
+void onFan(const char *payload, size_t length)
+{
+  fanCalls++;
+  snprintf(fanPayload, sizeof(fanPayload), "%.*s", (int)length, payload);
+}
+
+void onPicture(const char *payload, size_t length)
+{
+  pictureCalls++;
+}
+
+void onTopic(const char *topic)
+{
+  snprintf(subscribed, sizeof(subscribed), "%s", topic);
+}
+
+void withActions(RuleEngine &engine)
+{
+  engine.addAction(FAN_TOPIC, onFan);
+  engine.addAction(PICTURE_TOPIC, onPicture);
+}
+
+void test_rules_are_compiled()
+{
+  RuleEngine engine;
+  withActions(engine);
+
+  TEST_ASSERT_TRUE(engine.compile("temperature_f > 85 => " FAN_TOPIC ":300; aqi>=4=>" PICTURE_TOPIC));
+  TEST_ASSERT_EQUAL(2, engine._ruleCount);
+
+  Rule &fan = engine._rules[0];
+  TEST_ASSERT_EQUAL(fnv1a("temperature_f"), fan.signal);
+  TEST_ASSERT_EQUAL(RuleGreater, fan.op);
+  TEST_ASSERT_EQUAL(8500, fan.threshold);
+  TEST_ASSERT_EQUAL(0, fan.action);
+  TEST_ASSERT_EQUAL_STRING("300", fan.payload);
+
+  Rule &picture = engine._rules[1];
+  TEST_ASSERT_EQUAL(RuleGreaterOrEqual, picture.op);
+  TEST_ASSERT_EQUAL(400, picture.threshold);
+  TEST_ASSERT_EQUAL(1, picture.action);
+  TEST_ASSERT_EQUAL_STRING("", picture.payload);
+}
+
+void test_every_operator_is_parsed()
+{
+  const char *definitions[] = {"t > 1 => " FAN_TOPIC, "t >= 1 => " FAN_TOPIC, "t < 1 => " FAN_TOPIC,
+                               "t <= 1 => " FAN_TOPIC, "t == 1 => " FAN_TOPIC, "t != 1 => " FAN_TOPIC};
+  RuleOp ops[] = {RuleGreater, RuleGreaterOrEqual, RuleLess, RuleLessOrEqual, RuleEqual, RuleNotEqual};
+
+  for (int i = 0; i < 6; i++)
+  {
+    RuleEngine engine;
+    withActions(engine);
+    TEST_ASSERT_TRUE(engine.compile(definitions[i]));
+    TEST_ASSERT_EQUAL(ops[i], engine._rules[0].op);
+  }
+}
+
+// a definition with a bad rule leaves the rules compiled before in place
+void test_invalid_definitions_are_rejected()
+{
+  const char *definitions[] = {
+      "t",                                       // ends before the operator
+      "t >",                                     // no threshold
+      "t = 1 => " FAN_TOPIC,                     // not an operator
+      "> 1 => " FAN_TOPIC,                       // no signal
+      "t > 1 " FAN_TOPIC,                        // no arrow
+      "t > 1 => home/sprinkler/water",           // not one of the node's actions
+      "t > 1 => " FAN_TOPIC ":0123456789abcdef", // payload too long
+  };
+
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_TRUE(engine.compile("aqi >= 4 => " PICTURE_TOPIC));
+  for (const char *definition : definitions)
+  {
+    TEST_ASSERT_FALSE(engine.compile(definition));
+    TEST_ASSERT_EQUAL(1, engine._ruleCount);
+    TEST_ASSERT_EQUAL(fnv1a("aqi"), engine._rules[0].signal);
+  }
+}
+
+void test_overlong_definition_is_rejected()
+{
+  static char definition[1100];
+  memset(definition, ' ', sizeof(definition) - 1);
+  memcpy(definition, "t > 1 => " FAN_TOPIC, strlen("t > 1 => " FAN_TOPIC));
+  definition[sizeof(definition) - 1] = '\0';
+
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_FALSE(engine.compile(definition));
+  TEST_ASSERT_EQUAL(0, engine._ruleCount);
+}
+
+void test_only_the_first_rules_are_kept()
+{
+  static char definition[1024];
+  size_t length = 0;
+  for (int i = 0; i < RULE_MAX_RULES + 2; i++)
+  {
+    length += snprintf(definition + length, sizeof(definition) - length, "t > %d => " FAN_TOPIC "; ", i);
+  }
+
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_TRUE(engine.compile(definition));
+  TEST_ASSERT_EQUAL(RULE_MAX_RULES, engine._ruleCount);
+}
+
+void test_topic_signals_are_handed_out()
+{
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_TRUE(engine.compile("temperature_f > 85 => " FAN_TOPIC "; home/door/state == 1 => " PICTURE_TOPIC, onTopic));
+  TEST_ASSERT_EQUAL_STRING("home/door/state", subscribed);
+}
+
+// a rule fires when it becomes true, not for as long as it stays true
+void test_rules_fire_on_the_transition()
+{
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_TRUE(engine.compile("temperature_f > 85 => " FAN_TOPIC ":300"));
+
+  engine.onSensorPayload("{\"temperature_f\":80.5,\"humidity\":40}");
+  TEST_ASSERT_EQUAL(0, fanCalls);
+  engine.onSensorPayload("{\"temperature_f\":85.01}");
+  TEST_ASSERT_EQUAL(1, fanCalls);
+  TEST_ASSERT_EQUAL_STRING("300", fanPayload);
+  engine.onSensorPayload("{\"temperature_f\":90}");
+  TEST_ASSERT_EQUAL(1, fanCalls);
+  engine.onSensorPayload("{\"temperature_f\":85}");
+  engine.onSensorPayload("{\"temperature_f\":86}");
+  TEST_ASSERT_EQUAL(2, fanCalls);
+}
+
+void test_message_signals_are_evaluated()
+{
+  RuleEngine engine;
+  withActions(engine);
+  TEST_ASSERT_TRUE(engine.compile("home/door/state == 1 => " PICTURE_TOPIC));
+
+  engine.onMessage("home/door/state", "off");
+  engine.onMessage("home/door/state", "ajar");
+  engine.onMessage("home/window/state", "on");
+  TEST_ASSERT_EQUAL(0, pictureCalls);
+  engine.onMessage("home/door/state", "on");
+  TEST_ASSERT_EQUAL(1, pictureCalls);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_rules_are_compiled);
+  RUN_TEST(test_every_operator_is_parsed);
+  RUN_TEST(test_invalid_definitions_are_rejected);
+  RUN_TEST(test_overlong_definition_is_rejected);
+  RUN_TEST(test_only_the_first_rules_are_kept);
+  RUN_TEST(test_topic_signals_are_handed_out);
+  RUN_TEST(test_rules_fire_on_the_transition);
+  RUN_TEST(test_message_signals_are_evaluated);
+  return UNITY_END();
+}